@@ -0,0 +1,270 @@
+// Chess implemented in C; analyze.c implements batch analysis of every
+//   position of a PGN or EPD file. A reader queues positions into a bounded
+//   ring, worker threads each search them alone (with their own game and
+//   searcher), and a writer prints the results as EPD lines in input order.
+// Copyright (C) 2021 Theo Henson.
+// Released under the GPL v3.0, see LICENSE.
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "game.h"
+
+// Positions in flight between the reader and the writer
+#define ANALYZE_QUEUE_LEN 1024
+// Seconds between progress reports
+#define ANALYZE_REPORT_INTERVAL 5
+
+// A position and, once a worker is done with it, its result line
+struct {
+	char fen[FEN_LEN];
+	char id[64];
+	char result[FEN_LEN + 128];
+	int done;
+} typedef analyze_slot;
+
+// The ring between the stages: the reader fills slots at head, workers take
+//   them in order at next, and the writer empties them at tail
+static analyze_slot* slots;
+static unsigned long long head, next, tail;
+static int reading_done;
+static search_limits analyze_limits;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t not_full = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t queued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t finished = PTHREAD_COND_INITIALIZER;
+
+// Counters: nodes searched, positions waiting for a worker summed at each push
+//   (for the average), and how often each stage had to wait for another
+static unsigned long long total_nodes;
+static unsigned long long queued_sum;
+static unsigned long long reader_waits;
+static unsigned long long worker_waits;
+
+// Searches the position of a slot and writes its result line
+static void analyze_slot_position(analyze_slot* slot, game* g, searcher* s) {
+	load_fen(slot->fen, g);
+	// EPD positions leave out the move counts
+	int length = 0, spaces = 0;
+	while (slot->fen[length] && (slot->fen[length] != ' ' || ++spaces < 4))
+		length++;
+
+	char* p = slot->result;
+	p += sprintf(p, "%.*s", length, slot->fen);
+	if (!search_alone(s, g, &analyze_limits)) {
+		p += sprintf(p, " c0 \"%s\";", in_check(g) ? "checkmate" : "stalemate");
+	} else {
+		char san[SAN_LEN];
+		move_san(g, s->best, san);
+		p += sprintf(p, " bm %s;", san);
+		// Mates are given in moves, negative if the side to move is mated
+		if (s->score > MATE_BOUND)
+			p += sprintf(p, " dm %d;", (MATE_SCORE - s->score + 1) / 2);
+		else if (s->score < -MATE_BOUND)
+			p += sprintf(p, " dm -%d;", (MATE_SCORE + s->score) / 2);
+		else
+			p += sprintf(p, " ce %d;", s->score);
+		p += sprintf(p, " acd %d; acn %llu;", s->depth, s->nodes);
+	}
+	sprintf(p, " id \"%s\";\n", slot->id);
+}
+
+static void* analyze_worker(void* arg) {
+	game* g = malloc(sizeof(game));
+	searcher* s = malloc(sizeof(searcher));
+	if (!g || !s) {
+		fprintf(stderr, "chess: could not allocate analysis thread\n");
+		exit(1);
+	}
+
+	pthread_mutex_lock(&lock);
+	while (1) {
+		while (next == head && !reading_done) {
+			worker_waits++;
+			pthread_cond_wait(&queued, &lock);
+		}
+		if (next == head)
+			break;
+		analyze_slot* slot = &slots[next++ % ANALYZE_QUEUE_LEN];
+		pthread_mutex_unlock(&lock);
+
+		analyze_slot_position(slot, g, s);
+
+		pthread_mutex_lock(&lock);
+		total_nodes += s->nodes;
+		slot->done = 1;
+		pthread_cond_signal(&finished);
+	}
+	pthread_mutex_unlock(&lock);
+	free(s);
+	free(g);
+	stats_flush();
+	return NULL;
+}
+
+// Prints results as soon as every earlier one is printed
+static void* analyze_writer(void* arg) {
+	pthread_mutex_lock(&lock);
+	while (1) {
+		while (tail == head ? !reading_done : !slots[tail % ANALYZE_QUEUE_LEN].done)
+			pthread_cond_wait(&finished, &lock);
+		if (tail == head)
+			break;
+		analyze_slot* slot = &slots[tail % ANALYZE_QUEUE_LEN];
+		pthread_mutex_unlock(&lock);
+
+		fputs(slot->result, stdout);
+
+		pthread_mutex_lock(&lock);
+		slot->done = 0;
+		tail++;
+		pthread_cond_signal(&not_full);
+	}
+	pthread_mutex_unlock(&lock);
+	fflush(stdout);
+	return NULL;
+}
+
+// Queues a position, waiting while the ring is full
+static void push_position(game* g, char* id) {
+	pthread_mutex_lock(&lock);
+	while (head - tail >= ANALYZE_QUEUE_LEN) {
+		reader_waits++;
+		pthread_cond_wait(&not_full, &lock);
+	}
+	analyze_slot* slot = &slots[head % ANALYZE_QUEUE_LEN];
+	pthread_mutex_unlock(&lock);
+
+	write_fen(g, slot->fen);
+	snprintf(slot->id, sizeof(slot->id), "%s", id);
+
+	pthread_mutex_lock(&lock);
+	queued_sum += head - next;
+	head++;
+	pthread_cond_signal(&queued);
+	pthread_mutex_unlock(&lock);
+}
+
+// Prints how far the analysis has got
+static void report(unsigned long long start, int final) {
+	pthread_mutex_lock(&lock);
+	unsigned long long done = tail, read = head, waiting = head - next, nodes = total_nodes;
+	pthread_mutex_unlock(&lock);
+	unsigned long long elapsed = time_ns() - start;
+	double seconds = elapsed / 1e9;
+	if (!final) {
+		fprintf(stderr, "positions: %llu read, %llu written, %.0f/s, queued: %llu/%d\n",
+			read, done, seconds > 0 ? done / seconds : 0.0, waiting, ANALYZE_QUEUE_LEN);
+		return;
+	}
+	fprintf(stderr, "positions: %llu\n", done);
+	fprintf(stderr, "time: %.3fs\n", seconds);
+	fprintf(stderr, "positions/s: %.1f\n", seconds > 0 ? done / seconds : 0.0);
+	fprintf(stderr, "nodes: %llu, nps: %.0f\n", nodes, seconds > 0 ? nodes / seconds : 0.0);
+	fprintf(stderr, "queued on average: %.1f/%d, reader waits (queue full): %llu, worker waits (queue empty): %llu\n",
+		read ? (double)queued_sum / read : 0.0, ANALYZE_QUEUE_LEN, reader_waits, worker_waits);
+}
+
+// Reads every position of a PGN file (the start of each game and the position
+//   after each move), returns the number of errors
+static int read_pgn(FILE* f, game* g, unsigned long long start) {
+	pgn_reader r;
+	pgn_open(f, &r);
+	unsigned long long last_report = time_ns();
+	int ply = 0;
+	char id[64];
+	for (pgn_event e; (e = pgn_next(&r, g)) != pgn_done; ) {
+		ply = (e == pgn_game) ? 0 : ply + 1;
+		sprintf(id, "game %llu ply %d", r.games, ply);
+		push_position(g, id);
+		if (time_ns() - last_report >= ANALYZE_REPORT_INTERVAL * 1000000000ULL) {
+			report(start, 0);
+			last_report = time_ns();
+		}
+	}
+	return r.errors;
+}
+
+// Reads every position of an EPD file, returns the number of errors
+static int read_epd(FILE* f, game* g, unsigned long long start) {
+	epd_reader r;
+	epd_open(f, &r);
+	unsigned long long last_report = time_ns();
+	int errors = 0;
+	char id[64];
+	for (epd_event e; (e = epd_next(&r, g)) != epd_done; ) {
+		if (e != epd_position) {
+			fprintf(stderr, "chess: line %d: %s\n", r.line, (e == epd_long_line) ? "line too long" : "bad position");
+			errors++;
+			continue;
+		}
+		sprintf(id, "line %d", r.line);
+		push_position(g, id);
+		if (time_ns() - last_report >= ANALYZE_REPORT_INTERVAL * 1000000000ULL) {
+			report(start, 0);
+			last_report = time_ns();
+		}
+	}
+	return errors;
+}
+
+// Analyzes every position of a PGN or EPD file ("-" for standard input; PGN if
+//   the name ends in .pgn or the input starts with a tag) with the given limits,
+//   on as many workers as there are search threads; prints a line per position
+//   to standard output and the totals to standard error, returns the number of errors
+int analyze_run(char* path, search_limits* limits) {
+	FILE* f = strcmp(path, "-") ? fopen(path, "r") : stdin;
+	if (!f) {
+		fprintf(stderr, "chess: could not open %s\n", path);
+		return 1;
+	}
+	int c;
+	while ((c = getc(f)) == ' ' || c == '\t' || c == '\r' || c == '\n');
+	if (c != EOF)
+		ungetc(c, f);
+	int length = strlen(path);
+	int is_pgn = c == '[' || (length > 4 && strcmp(path + length - 4, ".pgn") == 0);
+
+	slots = calloc(ANALYZE_QUEUE_LEN, sizeof(analyze_slot));
+	game* g = malloc(sizeof(game));
+	if (!slots || !g) {
+		fprintf(stderr, "chess: could not allocate analysis queue\n");
+		exit(1);
+	}
+	head = next = tail = 0;
+	reading_done = 0;
+	total_nodes = queued_sum = reader_waits = worker_waits = 0;
+	analyze_limits = *limits;
+	analyze_limits.stop = analyze_limits.ponder = NULL;
+	tt_new_search();
+
+	int workers = search_threads();
+	pthread_t threads[MAX_THREADS];
+	pthread_t writer;
+	unsigned long long start = time_ns();
+	for (int i = 0; i < workers; i++)
+		pthread_create(&threads[i], NULL, analyze_worker, NULL);
+	pthread_create(&writer, NULL, analyze_writer, NULL);
+
+	int errors = is_pgn ? read_pgn(f, g, start) : read_epd(f, g, start);
+
+	pthread_mutex_lock(&lock);
+	reading_done = 1;
+	pthread_cond_broadcast(&queued);
+	pthread_cond_broadcast(&finished);
+	pthread_mutex_unlock(&lock);
+	for (int i = 0; i < workers; i++)
+		pthread_join(threads[i], NULL);
+	pthread_join(writer, NULL);
+
+	report(start, 1);
+	if (errors)
+		fprintf(stderr, "errors: %d\n", errors);
+	free(g);
+	free(slots);
+	if (f != stdin)
+		fclose(f);
+	return errors;
+}
@@ -0,0 +1,152 @@
+// Chess implemented in C; bench.c implements a benchmark of the hot paths
+//   (move generation, legality checking, attack detection, make and undo,
+//   perft and search) over a fixed set of positions. Searches go to a fixed
+//   depth on one thread with a cleared hash table, so the total nodes searched
+//   is a signature that only changes when the search or evaluation does.
+// Copyright (C) 2021 Theo Henson.
+// Released under the GPL v3.0, see LICENSE.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "game.h"
+
+// Repetitions of the quick operations per position, the perft depth, and the
+//   depth and hash size of each search
+#define BENCH_REPEAT 20000
+#define BENCH_PERFT_DEPTH 4
+#define BENCH_DEPTH 7
+#define BENCH_HASH_MB 16
+
+static char* bench_positions[] = {
+	"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+	"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+	"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+	"r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+	"rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+	"r1bq1rk1/pp2bppp/2n1pn2/3p4/2PP4/2N1PN2/PP1B1PPP/R2QKB1R w KQ - 0 8",
+	"2r3k1/1q1nbppp/r3p3/3pP3/pPpP4/P1Q2N2/2RN1PPP/2R3K1 b - - 0 1",
+	"6k1/5p2/6p1/8/7p/8/6PP/6K1 b - - 0 1",
+};
+#define BENCH_POSITION_COUNT (int)(sizeof(bench_positions) / sizeof(bench_positions[0]))
+
+// Written by the attack checks so that they can't be optimized away
+static volatile int bench_sink;
+
+// How long an operation took and how many times it ran (nodes for perft and search)
+struct {
+	const char* name;
+	unsigned long long count;
+	unsigned long long ns;
+} typedef bench_result;
+
+// Times one of the quick operations on every position
+static bench_result bench_operation(game* games, const char* name, int operation) {
+	bench_result r = { name, 0, 0 };
+	move_list l;
+	for (int p = 0; p < BENCH_POSITION_COUNT; p++) {
+		game* g = &games[p];
+		int c = COL_I(g->turn);
+		get_moves(g, c, &l);
+		unsigned long long start = time_ns();
+		for (int i = 0; i < BENCH_REPEAT; i++) {
+			switch (operation) {
+				case 0:
+					get_moves(g, c, &l);
+					r.count++;
+					break;
+				case 1:
+					// Generates pseudo-legal moves and plays each to drop those leaving the king in check
+					get_moves_filtered(g, c, &l);
+					r.count++;
+					break;
+				case 2:
+					// Asks whether the king's tile is attacked
+					bench_sink = in_check(g);
+					r.count++;
+					break;
+				case 3:
+					for (int j = 0; j < l.count; j++) {
+						make_move(g, l.moves[j]);
+						undo_move(g);
+					}
+					r.count += l.count;
+					break;
+			}
+		}
+		r.ns += time_ns() - start;
+	}
+	return r;
+}
+
+// Runs the benchmark, printing nanoseconds per operation and the signature as a
+//   table, CSV or JSON; returns the signature
+unsigned long long bench_run(bench_format format) {
+	static game games[BENCH_POSITION_COUNT];
+	for (int p = 0; p < BENCH_POSITION_COUNT; p++)
+		load_fen(bench_positions[p], &games[p]);
+
+	// Perft runs without the hash table so it measures the move generator, and
+	//   searches with a fixed size one on a single thread so their node counts repeat
+	int hash_mb = tt_size();
+	int threads = search_threads();
+	tt_resize(0);
+
+	bench_result results[6];
+	results[0] = bench_operation(games, "get_moves", 0);
+	results[1] = bench_operation(games, "filter_legal_moves", 1);
+	results[2] = bench_operation(games, "tile_attacked", 2);
+	results[3] = bench_operation(games, "make_undo_move", 3);
+
+	results[4] = (bench_result){ "perft", 0, 0 };
+	for (int p = 0; p < BENCH_POSITION_COUNT; p++) {
+		unsigned long long start = time_ns();
+		results[4].count += perft(&games[p], BENCH_PERFT_DEPTH);
+		results[4].ns += time_ns() - start;
+	}
+
+	tt_resize(BENCH_HASH_MB);
+	search_set_threads(1);
+	search_set_output(output_none);
+	search_limits limits = { .depth = BENCH_DEPTH, .time_ms = 0, .nodes = 0 };
+	results[5] = (bench_result){ "search", 0, 0 };
+	for (int p = 0; p < BENCH_POSITION_COUNT; p++) {
+		move best;
+		tt_clear();
+		unsigned long long start = time_ns();
+		search(&games[p], &limits, &best);
+		results[5].ns += time_ns() - start;
+		results[5].count += search_nodes();
+	}
+	search_set_output(output_text);
+	search_set_threads(threads);
+	tt_resize(hash_mb);
+	unsigned long long signature = results[5].count;
+
+	int count = sizeof(results) / sizeof(results[0]);
+	switch (format) {
+		case bench_text:
+			printf("%-20s %14s %10s\n", "operation", "count", "ns/op");
+			for (int i = 0; i < count; i++)
+				printf("%-20s %14llu %10.1f\n", results[i].name, results[i].count,
+					results[i].count ? (double)results[i].ns / results[i].count : 0.0);
+			printf("\nsignature: %llu\n", signature);
+			break;
+		case bench_csv:
+			printf("operation,count,ns_per_op\n");
+			for (int i = 0; i < count; i++)
+				printf("%s,%llu,%.1f\n", results[i].name, results[i].count,
+					results[i].count ? (double)results[i].ns / results[i].count : 0.0);
+			printf("signature,%llu,\n", signature);
+			break;
+		case bench_json:
+			printf("{\"operations\": [");
+			for (int i = 0; i < count; i++)
+				printf("%s\n  {\"name\": \"%s\", \"count\": %llu, \"ns_per_op\": %.1f}", i ? "," : "",
+					results[i].name, results[i].count,
+					results[i].count ? (double)results[i].ns / results[i].count : 0.0);
+			printf("\n], \"signature\": %llu}\n", signature);
+			break;
+	}
+	return signature;
+}
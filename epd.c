@@ -0,0 +1,234 @@
+// Chess implemented in C; epd.c implements reading EPD files and running EPD
+//   test suites, one position at a time so that files of any size run in the
+//   same memory.
+// Copyright (C) 2021 Theo Henson.
+// Released under the GPL v3.0, see LICENSE.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "game.h"
+
+// Most moves in a bm or am operation
+#define EPD_MAX_MOVES 16
+
+// Expectations of one EPD line
+struct {
+	char id[64];
+	// Perft counts by depth (D1 to D<n> operations), -1 where not given
+	long long perft[MAX_PLY];
+	int perft_depth;
+	// Moves that should (bm) or should not (am) be played, as written
+	char best[EPD_MAX_MOVES][SAN_LEN + 1];
+	int best_count;
+	char avoid[EPD_MAX_MOVES][SAN_LEN + 1];
+	int avoid_count;
+} typedef epd_line;
+
+// Splits off the first count space separated fields of a line (the position part
+//   of an EPD record), returns a pointer to the rest or NULL if there are fewer fields
+static char* split_fields(char* line, int count) {
+	char* p = line;
+	for (int i = 0; i < count; i++) {
+		while (*p == ' ' || *p == '\t')
+			p++;
+		if (!*p)
+			return NULL;
+		while (*p && *p != ' ' && *p != '\t')
+			p++;
+	}
+	if (*p)
+		*p++ = '\0';
+	return p;
+}
+
+// Starts reading an EPD file
+void epd_open(FILE* f, epd_reader* r) {
+	r->f = f;
+	r->line = 0;
+	r->operations = NULL;
+}
+
+// Reads the next line of an EPD file that isn't blank or a comment, setting up
+//   its position in g and leaving its operations in r->operations
+epd_event epd_next(epd_reader* r, game* g) {
+	while (fgets(r->text, sizeof(r->text), r->f)) {
+		r->line++;
+		size_t length = strlen(r->text);
+		if (length == sizeof(r->text) - 1 && r->text[length - 1] != '\n') {
+			// Drop the rest of a line too long to hold
+			int c;
+			while ((c = fgetc(r->f)) != EOF && c != '\n');
+			return epd_long_line;
+		}
+		r->text[strcspn(r->text, "\r\n")] = '\0';
+		if (r->text[strspn(r->text, " \t")] == '\0' || r->text[0] == '#')
+			continue;
+
+		// An EPD position is the first four FEN fields
+		r->operations = split_fields(r->text, 4);
+		if (!r->operations || load_fen(r->text, g))
+			return epd_bad_position;
+		return epd_position;
+	}
+	return epd_done;
+}
+
+// Reads the operations of an EPD record, e.g. "bm Nf3; id \"test 1\";" or ";D1 20 ;D2 400"
+static void parse_operations(char* text, epd_line* e) {
+	memset(e, 0, sizeof(*e));
+	for (int i = 0; i < MAX_PLY; i++)
+		e->perft[i] = -1;
+
+	for (char* op = strtok(text, ";"); op; op = strtok(NULL, ";")) {
+		char opcode[16];
+		int used = 0;
+		if (sscanf(op, " %15s %n", opcode, &used) != 1)
+			continue;
+		char* operands = op + used;
+
+		if (opcode[0] == 'D' && opcode[1] >= '1' && opcode[1] <= '9') {
+			int depth = atoi(opcode + 1);
+			if (depth < MAX_PLY) {
+				e->perft[depth] = atoll(operands);
+				if (depth > e->perft_depth)
+					e->perft_depth = depth;
+			}
+		} else if (strcmp(opcode, "id") == 0) {
+			char* start = strchr(operands, '"');
+			char* end = start ? strchr(start + 1, '"') : NULL;
+			if (end)
+				snprintf(e->id, sizeof(e->id), "%.*s", (int)(end - start - 1), start + 1);
+		} else if (strcmp(opcode, "bm") == 0 || strcmp(opcode, "am") == 0) {
+			int best = opcode[0] == 'b';
+			char move_text[SAN_LEN + 1];
+			int n;
+			while (sscanf(operands, " %8s%n", move_text, &n) == 1) {
+				operands += n;
+				if (best && e->best_count < EPD_MAX_MOVES)
+					strcpy(e->best[e->best_count++], move_text);
+				else if (!best && e->avoid_count < EPD_MAX_MOVES)
+					strcpy(e->avoid[e->avoid_count++], move_text);
+			}
+		}
+	}
+}
+
+// Returns whether a move is one of a list of written moves (-1 if one can't be read)
+static int move_in(game* g, move m, char list[][SAN_LEN + 1], int count) {
+	for (int i = 0; i < count; i++) {
+		move listed;
+		if (parse_move(g, list[i], &listed))
+			return -1;
+		if (listed == m)
+			return 1;
+	}
+	return 0;
+}
+
+// Runs every line of an EPD file ("-" for standard input): perft to each given
+//   depth up to max_depth (0 for all) for lines with D<n> operations, and a search
+//   with the given limits for lines with bm or am operations (skipped if limits is NULL)
+//   Prints a result per line and the totals, returns the number of failures
+int epd_run(char* path, int max_depth, search_limits* limits) {
+	FILE* f = strcmp(path, "-") ? fopen(path, "r") : stdin;
+	if (!f) {
+		fprintf(stderr, "chess: could not open %s\n", path);
+		return 1;
+	}
+	game* g = malloc(sizeof(game));
+	if (!g) {
+		fprintf(stderr, "chess: could not allocate game\n");
+		exit(1);
+	}
+	if (limits)
+		search_set_output(output_none);
+
+	epd_reader r;
+	epd_open(f, &r);
+	epd_line e;
+	int passed = 0, failed = 0, skipped = 0;
+	unsigned long long total_nodes = 0;
+	unsigned long long start = time_ns();
+	for (epd_event event; (event = epd_next(&r, g)) != epd_done; ) {
+		if (event != epd_position) {
+			printf("%d: skipped (%s)\n", r.line, (event == epd_long_line) ? "line too long" : "bad position");
+			skipped++;
+			continue;
+		}
+		parse_operations(r.operations, &e);
+		printf("%d%s%s: ", r.line, *e.id ? " " : "", e.id);
+
+		int ok = 1;
+		int ran = 0;
+		int checked_depth = 0;
+		unsigned long long nodes = 0;
+		for (int d = 1; d <= e.perft_depth && (max_depth <= 0 || d <= max_depth) && ok; d++) {
+			if (e.perft[d] < 0)
+				continue;
+			nodes = perft(g, d);
+			total_nodes += nodes;
+			checked_depth = d;
+			if ((long long)nodes != e.perft[d]) {
+				printf("FAIL perft depth %d: %llu (expected %lld)", d, nodes, e.perft[d]);
+				ok = 0;
+			}
+		}
+		if (checked_depth) {
+			ran = 1;
+			if (ok)
+				printf("ok perft depth %d: %llu", checked_depth, nodes);
+		}
+
+		if (ok && limits && (e.best_count || e.avoid_count)) {
+			move best;
+			char san[SAN_LEN];
+			if (ran)
+				printf(", ");
+			ran = 1;
+			if (!search(g, limits, &best)) {
+				printf("FAIL no moves");
+				ok = 0;
+			} else {
+				total_nodes += search_nodes();
+				move_san(g, best, san);
+				int in_best = move_in(g, best, e.best, e.best_count);
+				int in_avoid = move_in(g, best, e.avoid, e.avoid_count);
+				if (in_best < 0 || in_avoid < 0) {
+					printf("FAIL bad move in bm or am");
+					ok = 0;
+				} else if ((e.best_count && !in_best) || in_avoid) {
+					printf("FAIL played %s", san);
+					ok = 0;
+				} else {
+					printf("ok played %s", san);
+				}
+			}
+		}
+
+		if (!ran) {
+			printf("skipped (nothing to check)\n");
+			skipped++;
+			continue;
+		}
+		printf("\n");
+		if (ok)
+			passed++;
+		else
+			failed++;
+	}
+
+	unsigned long long elapsed = time_ns() - start;
+	printf("\npassed: %d, failed: %d, skipped: %d\n", passed, failed, skipped);
+	printf("nodes: %llu\n", total_nodes);
+	printf("time: %.3fs\n", elapsed / 1e9);
+	printf("nps: %.0f\n", elapsed ? total_nodes * 1e9 / elapsed : 0.0);
+
+	if (limits)
+		search_set_output(output_text);
+	free(g);
+	if (f != stdin)
+		fclose(f);
+	return failed;
+}
@@ -0,0 +1,326 @@
+// Chess implemented in C; eval.c implements static evaluation of positions,
+//   from material and piece-square scores that make_move and undo_move keep
+//   up to date, blended between the middlegame and the endgame by the pieces left.
+// Copyright (C) 2021 Theo Henson.
+// Released under the GPL v3.0, see LICENSE.
+
+#include "game.h"
+
+// Entries in each thread's pawn structure table (a power of two)
+#define PAWN_TABLE_SIZE 8192
+
+// Game phase of each piece type, the most (all pieces on the board) is TOTAL_PHASE
+#define TOTAL_PHASE 24
+static const int phase_values[6] = { 0, 1, 1, 2, 4, 0 };
+
+// Piece values in centipawns, indexed by piece type
+const int piece_values[6] = { 100, 320, 330, 500, 900, 0 };
+static const int mg_values[6] = { 82, 337, 365, 477, 1025, 0 };
+static const int eg_values[6] = { 94, 281, 297, 512, 936, 0 };
+
+// Piece-square bonuses for white in the middlegame and endgame, written
+//   with rank 8 at the top (so a tile's entry is at tile ^ 56)
+static const int mg_bonus[6][64] = {
+	{
+		  0,   0,   0,   0,   0,   0,   0,   0,
+		 50,  50,  50,  50,  50,  50,  50,  50,
+		 10,  10,  20,  30,  30,  20,  10,  10,
+		  5,   5,  10,  25,  25,  10,   5,   5,
+		  0,   0,   0,  20,  20,   0,   0,   0,
+		  5,  -5, -10,   0,   0, -10,  -5,   5,
+		  5,  10,  10, -20, -20,  10,  10,   5,
+		  0,   0,   0,   0,   0,   0,   0,   0
+	}, {
+		-50, -40, -30, -30, -30, -30, -40, -50,
+		-40, -20,   0,   0,   0,   0, -20, -40,
+		-30,   0,  10,  15,  15,  10,   0, -30,
+		-30,   5,  15,  20,  20,  15,   5, -30,
+		-30,   0,  15,  20,  20,  15,   0, -30,
+		-30,   5,  10,  15,  15,  10,   5, -30,
+		-40, -20,   0,   5,   5,   0, -20, -40,
+		-50, -40, -30, -30, -30, -30, -40, -50
+	}, {
+		-20, -10, -10, -10, -10, -10, -10, -20,
+		-10,   0,   0,   0,   0,   0,   0, -10,
+		-10,   0,   5,  10,  10,   5,   0, -10,
+		-10,   5,   5,  10,  10,   5,   5, -10,
+		-10,   0,  10,  10,  10,  10,   0, -10,
+		-10,  10,  10,  10,  10,  10,  10, -10,
+		-10,   5,   0,   0,   0,   0,   5, -10,
+		-20, -10, -10, -10, -10, -10, -10, -20
+	}, {
+		  0,   0,   0,   0,   0,   0,   0,   0,
+		  5,  10,  10,  10,  10,  10,  10,   5,
+		 -5,   0,   0,   0,   0,   0,   0,  -5,
+		 -5,   0,   0,   0,   0,   0,   0,  -5,
+		 -5,   0,   0,   0,   0,   0,   0,  -5,
+		 -5,   0,   0,   0,   0,   0,   0,  -5,
+		 -5,   0,   0,   0,   0,   0,   0,  -5,
+		  0,   0,   0,   5,   5,   0,   0,   0
+	}, {
+		-20, -10, -10,  -5,  -5, -10, -10, -20,
+		-10,   0,   0,   0,   0,   0,   0, -10,
+		-10,   0,   5,   5,   5,   5,   0, -10,
+		 -5,   0,   5,   5,   5,   5,   0,  -5,
+		  0,   0,   5,   5,   5,   5,   0,  -5,
+		-10,   5,   5,   5,   5,   5,   0, -10,
+		-10,   0,   5,   0,   0,   0,   0, -10,
+		-20, -10, -10,  -5,  -5, -10, -10, -20
+	}, {
+		-30, -40, -40, -50, -50, -40, -40, -30,
+		-30, -40, -40, -50, -50, -40, -40, -30,
+		-30, -40, -40, -50, -50, -40, -40, -30,
+		-30, -40, -40, -50, -50, -40, -40, -30,
+		-20, -30, -30, -40, -40, -30, -30, -20,
+		-10, -20, -20, -20, -20, -20, -20, -10,
+		 20,  20,   0,   0,   0,   0,  20,  20,
+		 20,  30,  10,   0,   0,  10,  30,  20
+	}
+};
+
+// In the endgame pawns are pushed on and the king comes to the center
+static const int eg_bonus[6][64] = {
+	{
+		  0,   0,   0,   0,   0,   0,   0,   0,
+		 80,  80,  80,  80,  80,  80,  80,  80,
+		 50,  50,  50,  50,  50,  50,  50,  50,
+		 30,  30,  30,  30,  30,  30,  30,  30,
+		 15,  15,  15,  15,  15,  15,  15,  15,
+		  5,   5,   5,   5,   5,   5,   5,   5,
+		  0,   0,   0,   0,   0,   0,   0,   0,
+		  0,   0,   0,   0,   0,   0,   0,   0
+	}, {
+		-50, -40, -30, -30, -30, -30, -40, -50,
+		-40, -20,   0,   0,   0,   0, -20, -40,
+		-30,   0,  10,  15,  15,  10,   0, -30,
+		-30,   5,  15,  20,  20,  15,   5, -30,
+		-30,   0,  15,  20,  20,  15,   0, -30,
+		-30,   5,  10,  15,  15,  10,   5, -30,
+		-40, -20,   0,   5,   5,   0, -20, -40,
+		-50, -40, -30, -30, -30, -30, -40, -50
+	}, {
+		-20, -10, -10, -10, -10, -10, -10, -20,
+		-10,   0,   0,   0,   0,   0,   0, -10,
+		-10,   0,   5,  10,  10,   5,   0, -10,
+		-10,   5,   5,  10,  10,   5,   5, -10,
+		-10,   0,  10,  10,  10,  10,   0, -10,
+		-10,  10,  10,  10,  10,  10,  10, -10,
+		-10,   5,   0,   0,   0,   0,   5, -10,
+		-20, -10, -10, -10, -10, -10, -10, -20
+	}, {
+		  0,   0,   0,   0,   0,   0,   0,   0,
+		 10,  10,  10,  10,  10,  10,  10,  10,
+		  0,   0,   0,   0,   0,   0,   0,   0,
+		  0,   0,   0,   0,   0,   0,   0,   0,
+		  0,   0,   0,   0,   0,   0,   0,   0,
+		  0,   0,   0,   0,   0,   0,   0,   0,
+		  0,   0,   0,   0,   0,   0,   0,   0,
+		  0,   0,   0,   0,   0,   0,   0,   0
+	}, {
+		-20, -10, -10,  -5,  -5, -10, -10, -20,
+		-10,   0,   0,   0,   0,   0,   0, -10,
+		-10,   0,   5,   5,   5,   5,   0, -10,
+		 -5,   0,   5,   5,   5,   5,   0,  -5,
+		 -5,   0,   5,   5,   5,   5,   0,  -5,
+		-10,   0,   5,   5,   5,   5,   0, -10,
+		-10,   0,   0,   0,   0,   0,   0, -10,
+		-20, -10, -10,  -5,  -5, -10, -10, -20
+	}, {
+		-50, -40, -30, -20, -20, -30, -40, -50,
+		-30, -20, -10,   0,   0, -10, -20, -30,
+		-30, -10,  20,  30,  30,  20, -10, -30,
+		-30, -10,  30,  40,  40,  30, -10, -30,
+		-30, -10,  30,  40,  40,  30, -10, -30,
+		-30, -10,  20,  30,  30,  20, -10, -30,
+		-30, -30,   0,   0,   0,   0, -30, -30,
+		-50, -30, -30, -30, -30, -30, -30, -50
+	}
+};
+
+// Value plus bonus of each piece on each tile, negative for black
+int mg_table[2][6][64];
+int eg_table[2][6][64];
+
+// Light tiles (b1, d1 ... h8), and the a and h files
+#define LIGHT_TILES 0x55aa55aa55aa55aaULL
+#define FILE_A 0x0101010101010101ULL
+#define FILE_H 0x8080808080808080ULL
+
+// Pawn structure scores for each color index as (middlegame, endgame) pairs
+static const int doubled_penalty[2] = { 10, 20 };
+static const int isolated_penalty[2] = { 10, 15 };
+static const int backward_penalty[2] = { 8, 10 };
+// Passed pawn bonus by ranks advanced
+static const int passed_bonus[2][8] = {
+	{ 0, 5, 10, 15, 25, 40, 60, 0 },
+	{ 0, 10, 20, 35, 60, 90, 130, 0 }
+};
+// Middlegame bonus of each pawn in front of the king
+#define SHIELD_BONUS 8
+
+// Tiles of a file and the files next to it, tiles ahead of a tile on its own
+//   and the next files (for passed pawns), tiles behind or level with a tile
+//   on the next files (its supporters), and up to two tiles ahead of a king on
+//   its own and the next files (its pawn shield)
+static bitboard file_masks[8];
+static bitboard adjacent_files[8];
+static bitboard passed_masks[2][64];
+static bitboard support_masks[2][64];
+static bitboard shield_masks[2][64];
+
+// A cached pawn structure score, from white's side
+struct {
+	unsigned long long key;
+	int mg;
+	int eg;
+} typedef pawn_entry;
+
+// Each search thread keeps its own table, as pawn structures repeat within a thread's tree
+static __thread pawn_entry pawn_table[PAWN_TABLE_SIZE];
+
+// Fills the piece-square tables (black's are white's flipped to its side of the board)
+void compute_eval_tables() {
+	for (int type = pawn; type <= king; type++) {
+		for (int tile = 0; tile < 64; tile++) {
+			mg_table[0][type][tile] = mg_values[type] + mg_bonus[type][tile ^ 56];
+			eg_table[0][type][tile] = eg_values[type] + eg_bonus[type][tile ^ 56];
+			mg_table[1][type][tile] = -(mg_values[type] + mg_bonus[type][tile]);
+			eg_table[1][type][tile] = -(eg_values[type] + eg_bonus[type][tile]);
+		}
+	}
+
+	for (int file = 0; file < 8; file++) {
+		file_masks[file] = FILE_A << file;
+		adjacent_files[file] = ((file > 0) ? FILE_A << (file - 1) : 0) | ((file < 7) ? FILE_A << (file + 1) : 0);
+	}
+	for (int tile = 0; tile < 64; tile++) {
+		int file = tile % 8, rank = tile / 8;
+		bitboard span = file_masks[file] | adjacent_files[file];
+		// Ranks above (white) and below (black) this one
+		bitboard above = (rank < 7) ? ~0ULL << ((rank + 1) * 8) : 0;
+		bitboard below = (rank > 0) ? ~0ULL >> ((8 - rank) * 8) : 0;
+		passed_masks[0][tile] = span & above;
+		passed_masks[1][tile] = span & below;
+		support_masks[0][tile] = adjacent_files[file] & ~above;
+		support_masks[1][tile] = adjacent_files[file] & ~below;
+		bitboard near_above = above & ((rank < 5) ? ~0ULL >> ((5 - rank) * 8) : ~0ULL);
+		bitboard near_below = below & ((rank > 1) ? ~0ULL << ((rank - 2) * 8) : ~0ULL);
+		shield_masks[0][tile] = span & near_above;
+		shield_masks[1][tile] = span & near_below;
+	}
+}
+
+// Tiles attacked by the pawns of color index c
+static bitboard pawn_attack_tiles(bitboard pawns, int c) {
+	if (c == 0)
+		return ((pawns & ~FILE_A) << 7) | ((pawns & ~FILE_H) << 9);
+	return ((pawns & ~FILE_A) >> 9) | ((pawns & ~FILE_H) >> 7);
+}
+
+// Scores the pawns of color index c: doubled, isolated, backward (behind
+//   the pawns next to it and unable to advance safely) and passed pawns
+static void score_pawns(game* g, int c, int* mg, int* eg) {
+	bitboard own = g->bitboards[c][pawn];
+	bitboard enemy = g->bitboards[!c][pawn];
+	bitboard enemy_attacks = pawn_attack_tiles(enemy, !c);
+	for (bitboard b = own; b; b &= b - 1) {
+		int tile = LSB(b);
+		int file = tile % 8;
+		int advanced = c ? 7 - tile / 8 : tile / 8;
+		int stop = tile + (c ? -8 : 8);
+
+		if (own & passed_masks[c][tile] & file_masks[file]) {
+			*mg -= doubled_penalty[0];
+			*eg -= doubled_penalty[1];
+		}
+		if (!(own & adjacent_files[file])) {
+			*mg -= isolated_penalty[0];
+			*eg -= isolated_penalty[1];
+		} else if (!(own & support_masks[c][tile]) && (enemy_attacks & BIT(stop))) {
+			*mg -= backward_penalty[0];
+			*eg -= backward_penalty[1];
+		}
+		if (!(enemy & passed_masks[c][tile])) {
+			*mg += passed_bonus[0][advanced];
+			*eg += passed_bonus[1][advanced];
+		}
+	}
+}
+
+// Returns the pawn structure score of both sides from white's side,
+//   computing it only if the pawns aren't in the thread's table
+static void pawn_structure(game* g, int* mg, int* eg) {
+	pawn_entry* e = &pawn_table[g->pawn_hash & (PAWN_TABLE_SIZE - 1)];
+	tt_counters.pawn_probes++;
+	if (e->key == g->pawn_hash) {
+		tt_counters.pawn_hits++;
+		*mg = e->mg;
+		*eg = e->eg;
+		return;
+	}
+
+	int white_mg = 0, white_eg = 0, black_mg = 0, black_eg = 0;
+	score_pawns(g, 0, &white_mg, &white_eg);
+	score_pawns(g, 1, &black_mg, &black_eg);
+	e->key = g->pawn_hash;
+	e->mg = *mg = white_mg - black_mg;
+	e->eg = *eg = white_eg - black_eg;
+}
+
+// Sets the material signature and scores of a game from its bitboards
+void score_position(game* g) {
+	g->material = 0;
+	g->mg_score = 0;
+	g->eg_score = 0;
+	for (int c = 0; c < 2; c++) {
+		for (int type = pawn; type <= king; type++) {
+			for (bitboard b = g->bitboards[c][type]; b; b &= b - 1) {
+				g->material += MATERIAL_ONE(c, type);
+				g->mg_score += mg_table[c][type][LSB(b)];
+				g->eg_score += eg_table[c][type][LSB(b)];
+			}
+		}
+	}
+}
+
+// Returns whether neither side has the pieces left to ever checkmate: bare kings,
+//   a single minor piece, or only bishops all on tiles of one color
+int insufficient_material(game* g) {
+	unsigned long long kings = MATERIAL_ONE(0, king) | MATERIAL_ONE(1, king);
+	unsigned long long minors = 0;
+	for (int c = 0; c < 2; c++)
+		minors += MATERIAL_ONE(c, knight) * MATERIAL_COUNT(g->material, c, knight) +
+			MATERIAL_ONE(c, bishop) * MATERIAL_COUNT(g->material, c, bishop);
+	if (g->material != kings + minors)
+		return 0;
+
+	int knights = MATERIAL_COUNT(g->material, 0, knight) + MATERIAL_COUNT(g->material, 1, knight);
+	int bishops = MATERIAL_COUNT(g->material, 0, bishop) + MATERIAL_COUNT(g->material, 1, bishop);
+	if (knights + bishops <= 1)
+		return 1;
+	bitboard all_bishops = g->bitboards[0][bishop] | g->bitboards[1][bishop];
+	return knights == 0 && (!(all_bishops & LIGHT_TILES) || !(all_bishops & ~LIGHT_TILES));
+}
+
+// Returns the score of the position from the perspective of the side to move,
+//   tapered from the middlegame to the endgame score as pieces come off
+int evaluate(game* g) {
+	int phase = 0;
+	for (int type = knight; type <= queen; type++)
+		phase += phase_values[type] *
+			(MATERIAL_COUNT(g->material, 0, type) + MATERIAL_COUNT(g->material, 1, type));
+	if (phase > TOTAL_PHASE)
+		phase = TOTAL_PHASE;
+
+	int mg, eg;
+	pawn_structure(g, &mg, &eg);
+	mg += g->mg_score;
+	eg += g->eg_score;
+
+	// Pawns in front of each king (which depends on the king, so isn't cached)
+	mg += SHIELD_BONUS * (POPCOUNT(shield_masks[0][g->king_tiles[0]] & g->bitboards[0][pawn]) -
+		POPCOUNT(shield_masks[1][g->king_tiles[1]] & g->bitboards[1][pawn]));
+
+	int score = (mg * phase + eg * (TOTAL_PHASE - phase)) / TOTAL_PHASE;
+	return (g->turn == white) ? score : -score;
+}
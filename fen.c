@@ -1,8 +1,10 @@
-// Chess implemented in C; fen.c implements parsing of the FEN notation.
+// Chess implemented in C; fen.c implements reading and writing the FEN
+//   notation of positions, and the notations of moves.
 // Copyright (C) 2021 Theo Henson.
 // Released under the GPL v3.0, see LICENSE.
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <ctype.h>
 #include <string.h>
 
@@ -13,7 +15,7 @@ char ptoc(int piece) {
 	if (piece == 0)
 		return '-';
 
-	char c;
+	char c = 0;
 	switch (PIECE_TYPE(piece)) {
 		case pawn:
 			c = 'p';
@@ -70,34 +72,153 @@ int ctop(char c) {
 	return piece;
 }
 
-// Populates game board from FEN string
-void load_fen(char* fen, game* g) {
+// Writes the coordinate notation of a move (e.g. "e2e4" or "e7e8q") into buf
+void move_notation(move m, char buf[6]) {
+	buf[0] = 'a' + MOVE_START(m) % 8;
+	buf[1] = '1' + MOVE_START(m) / 8;
+	buf[2] = 'a' + MOVE_END(m) % 8;
+	buf[3] = '1' + MOVE_END(m) / 8;
+	buf[4] = MOVE_PROMOTION(m) ? ptoc(black | MOVE_PROMOTION(m)) : '\0';
+	buf[5] = '\0';
+}
+
+// Copies the next space separated field of a string into buf and moves past it,
+//   returns 0 if there are no more fields (or the field doesn't fit)
+static int next_field(char** text, char* buf, int size) {
+	char* p = *text;
+	while (*p == ' ')
+		p++;
+	int length = 0;
+	while (p[length] && p[length] != ' ')
+		length++;
+	if (length == 0 || length >= size)
+		return 0;
+	memcpy(buf, p, length);
+	buf[length] = '\0';
+	*text = p + length;
+	return 1;
+}
+
+// Parses a whole non-negative number, returns -1 if it isn't one
+static int parse_count(char* text) {
+	char* end;
+	long n = strtol(text, &end, 10);
+	if (end == text || *end || n < 0 || n > 1000000)
+		return -1;
+	return (int)n;
+}
+
+// Populates game board from FEN string, resetting any previous game state
+//   Fields after the piece placement may be left off; missing castling rights
+//   are assumed wherever the king and rook are on their starting tiles
+//   Returns 1 if the FEN is invalid, in which case the game must not be used
+int load_fen(char* fen, game* g) {
+	char field[FEN_LEN];
+	int board[64] = { 0 };
+	int counts[2] = { 0, 0 };
+	int kings[2] = { 0, 0 };
+
+	// Parse the piece placement, rank 8 first
+	if (!next_field(&fen, field, sizeof(field)))
+		return 1;
 	int file = 0;
 	int rank = 7;
-
-	// Parse FEN data into board
-	for (int i = 0; i < strlen(fen); i++) {
-		if (fen[i] == ' ') {
-			// TODO: handle other FEN data
-			break;
-		} else if (fen[i] == '/') {
+	for (char* p = field; *p; p++) {
+		if (*p == '/') {
+			if (file != 8 || rank == 0)
+				return 1;
 			file = 0;
 			rank--;
+		} else if (*p >= '1' && *p <= '8') {
+			file += *p - '0';
+			if (file > 8)
+				return 1;
 		} else {
-			if (isdigit(fen[i])) {
-				file += (int)(fen[i] - '0');
-			} else {
-				g->board[rank * 8 + file] = ctop(fen[i]);
-				file++;
+			int piece = ctop(*p);
+			if (!piece || file > 7)
+				return 1;
+			// Pawns can't be on the first or last rank
+			if (PIECE_TYPE(piece) == pawn && (rank == 0 || rank == 7))
+				return 1;
+			if (PIECE_TYPE(piece) == king)
+				kings[COL_I(piece)]++;
+			if (++counts[COL_I(piece)] > MAX_PIECES)
+				return 1;
+			board[rank * 8 + file++] = piece;
+		}
+	}
+	if (rank != 0 || file != 8 || kings[0] != 1 || kings[1] != 1)
+		return 1;
+
+	// Parse the other fields
+	piece_color turn = white;
+	int castle_rights = -1;
+	int en_passant = -1;
+	int halfmove_clock = 0;
+	int fullmove = 1;
+	if (next_field(&fen, field, sizeof(field))) {
+		if (strcmp(field, "w") == 0)
+			turn = white;
+		else if (strcmp(field, "b") == 0)
+			turn = black;
+		else
+			return 1;
+	}
+	if (next_field(&fen, field, sizeof(field))) {
+		castle_rights = 0;
+		for (char* p = field; *p && strcmp(field, "-"); p++) {
+			int right;
+			switch (*p) {
+				case 'K':
+					right = CASTLE_RIGHT(0, 1);
+					break;
+				case 'Q':
+					right = CASTLE_RIGHT(0, 0);
+					break;
+				case 'k':
+					right = CASTLE_RIGHT(1, 1);
+					break;
+				case 'q':
+					right = CASTLE_RIGHT(1, 0);
+					break;
+				default:
+					return 1;
 			}
+			castle_rights |= right;
 		}
 	}
+	if (next_field(&fen, field, sizeof(field)) && strcmp(field, "-")) {
+		// Only the tile skipped by a pawn of the side that just moved
+		if (strlen(field) != 2 || field[0] < 'a' || field[0] > 'h' || field[1] != ((turn == white) ? '6' : '3'))
+			return 1;
+		en_passant = (field[1] - '1') * 8 + (field[0] - 'a');
+	}
+	if (next_field(&fen, field, sizeof(field)) && (halfmove_clock = parse_count(field)) < 0)
+		return 1;
+	if (next_field(&fen, field, sizeof(field)) && (fullmove = parse_count(field)) < 1)
+		return 1;
+
+	memcpy(g->board, board, sizeof(g->board));
+	g->turn = turn;
+	g->halfmove_clock = halfmove_clock;
+	g->fullmove = fullmove;
+	g->piece_count[0] = 0;
+	g->piece_count[1] = 0;
+	g->ply = 0;
+	g->ended = not_finished;
 
-	// Create tile lists from board
-	piece_list* pl_white = NULL;
-	piece_list* pl_black = NULL;
+	// Create piece lists and bitboards from board
+	memset(g->bitboards, 0, sizeof(g->bitboards));
+	memset(g->occupancy, 0, sizeof(g->occupancy));
 	for (int i = 0; i < 64; i++) {
 		if (g->board[i] != 0) {
+			int c = COL_I(g->board[i]);
+			g->piece_index[i] = g->piece_count[c];
+			g->pieces[c][g->piece_count[c]++] = i;
+
+			g->bitboards[c][PIECE_TYPE(g->board[i])] |= BIT(i);
+			g->occupancy[c] |= BIT(i);
+
 			// King tile
 			if (PIECE_TYPE(g->board[i]) == king) {
 				if (PIECE_COLOR(g->board[i]) == white)
@@ -105,17 +226,236 @@ void load_fen(char* fen, game* g) {
 				else
 					g->king_tiles[1] = i;
 			}
+		}
+	}
 
-			piece_list* p = malloc(sizeof(piece_list*));
-			p->tile = i;
-			switch (PIECE_COLOR(g->board[i])) {
-				case white:
-					APPEND_LIST(pl_white, g->pieces[0], p);
-					break;
-				case black:
-					APPEND_LIST(pl_black, g->pieces[1], p);
-					break;
+	// Castling rights are only kept while the king and rook are on their starting tiles
+	g->castle_rights = 0;
+	for (int c = 0; c < 2; c++) {
+		int color = c ? black : white;
+		if (g->board[c * 56 + 4] != (color | king))
+			continue;
+		if (g->board[c * 56] == (color | rook))
+			g->castle_rights |= CASTLE_RIGHT(c, 0);
+		if (g->board[c * 56 + 7] == (color | rook))
+			g->castle_rights |= CASTLE_RIGHT(c, 1);
+	}
+	if (castle_rights != -1)
+		g->castle_rights &= castle_rights;
+
+	// Like make_move, only keep the en passant tile if a pawn can capture there
+	g->en_passant = -1;
+	if (en_passant != -1) {
+		int pushed = en_passant + ((turn == white) ? -8 : 8);
+		int own_pawn = turn | pawn;
+		if (g->board[en_passant] == 0 && g->board[pushed] == (PIECE_OCOLOR(own_pawn) | pawn) &&
+			((pushed % 8 > 0 && g->board[pushed - 1] == own_pawn) ||
+			(pushed % 8 < 7 && g->board[pushed + 1] == own_pawn)))
+			g->en_passant = en_passant;
+	}
+
+	g->hash = hash_position(g);
+	g->pawn_hash = hash_pawns(g);
+	score_position(g);
+
+	// The side that just moved can't have left its king in check
+	g->turn = PIECE_OCOLOR(turn);
+	int illegal = in_check(g);
+	g->turn = turn;
+	return illegal;
+}
+
+// Writes the FEN of a position into buf
+void write_fen(game* g, char buf[FEN_LEN]) {
+	char* p = buf;
+	for (int rank = 7; rank >= 0; rank--) {
+		int empty = 0;
+		for (int file = 0; file < 8; file++) {
+			int piece = g->board[rank * 8 + file];
+			if (!piece) {
+				empty++;
+				continue;
+			}
+			if (empty)
+				*p++ = '0' + empty;
+			empty = 0;
+			*p++ = ptoc(piece);
+		}
+		if (empty)
+			*p++ = '0' + empty;
+		if (rank)
+			*p++ = '/';
+	}
+
+	*p++ = ' ';
+	*p++ = (g->turn == white) ? 'w' : 'b';
+	*p++ = ' ';
+	if (g->castle_rights & CASTLE_RIGHT(0, 1))
+		*p++ = 'K';
+	if (g->castle_rights & CASTLE_RIGHT(0, 0))
+		*p++ = 'Q';
+	if (g->castle_rights & CASTLE_RIGHT(1, 1))
+		*p++ = 'k';
+	if (g->castle_rights & CASTLE_RIGHT(1, 0))
+		*p++ = 'q';
+	if (!g->castle_rights)
+		*p++ = '-';
+	*p++ = ' ';
+	if (g->en_passant != -1) {
+		*p++ = 'a' + g->en_passant % 8;
+		*p++ = '1' + g->en_passant / 8;
+	} else {
+		*p++ = '-';
+	}
+	sprintf(p, " %d %d", g->halfmove_clock, g->fullmove);
+}
+
+// Writes the standard algebraic notation of a legal move (e.g. "Nbd7", "exd6" or "O-O+") into buf
+void move_san(game* g, move m, char buf[SAN_LEN]) {
+	int start = MOVE_START(m), end = MOVE_END(m);
+	int piece = g->board[start];
+	char* p = buf;
+
+	if (MOVE_FLAG(m) == flag_castle_right || MOVE_FLAG(m) == flag_castle_left) {
+		strcpy(p, (MOVE_FLAG(m) == flag_castle_right) ? "O-O" : "O-O-O");
+		p += strlen(p);
+	} else {
+		int capture = MOVE_CAPTURE(m);
+		if (PIECE_TYPE(piece) == pawn) {
+			if (capture)
+				*p++ = 'a' + start % 8;
+		} else {
+			*p++ = ptoc(white | PIECE_TYPE(piece));
+
+			// Tell apart other pieces of the same kind that can reach the same tile
+			move_list l;
+			get_moves(g, COL_I(piece), &l);
+			int others = 0, same_file = 0, same_rank = 0;
+			for (int i = 0; i < l.count; i++) {
+				int other = MOVE_START(l.moves[i]);
+				if (MOVE_END(l.moves[i]) != end || other == start || g->board[other] != piece)
+					continue;
+				others = 1;
+				same_file |= (other % 8 == start % 8);
+				same_rank |= (other / 8 == start / 8);
+			}
+			if (others && (!same_file || same_rank))
+				*p++ = 'a' + start % 8;
+			if (others && same_file)
+				*p++ = '1' + start / 8;
+		}
+		if (capture)
+			*p++ = 'x';
+		*p++ = 'a' + end % 8;
+		*p++ = '1' + end / 8;
+		if (MOVE_PROMOTION(m)) {
+			*p++ = '=';
+			*p++ = ptoc(white | MOVE_PROMOTION(m));
+		}
+	}
+
+	// Check and checkmate
+	make_move(g, m);
+	if (in_check(g)) {
+		move_list replies;
+		get_moves(g, COL_I(g->turn), &replies);
+		*p++ = replies.count ? '+' : '#';
+	}
+	undo_move(g);
+	*p = '\0';
+}
+
+// Returns the length of a move's text without check marks or annotations
+static int move_text_length(char* text) {
+	int length = strlen(text);
+	while (length > 0 && strchr("+#!?", text[length - 1]))
+		length--;
+	return length;
+}
+
+// Finds the legal move written in standard algebraic notation (without
+//   check marks), matching its piece, end tile, any tiles it gives of the
+//   start and any promotion; returns 1 if there isn't exactly one
+static int parse_san(game* g, char* text, int length, move* m) {
+	move_list l;
+	get_moves(g, COL_I(g->turn), &l);
+
+	// Castling, also written with zeros
+	int castle = -1;
+	if ((length == 3 || length == 5) && strspn(text, "O0-") >= length)
+		castle = (length == 3) ? flag_castle_right : flag_castle_left;
+	if (castle != -1) {
+		for (int i = 0; i < l.count; i++) {
+			if (MOVE_FLAG(l.moves[i]) == castle) {
+				*m = l.moves[i];
+				return 0;
+			}
+		}
+		return 1;
+	}
+
+	// Piece letters are capitals, so a lone "b" is a pawn on the b file
+	int type = pawn;
+	int i = 0;
+	if (length > 0 && strchr("NBRQK", text[0])) {
+		type = PIECE_TYPE(ctop(text[0]));
+		i = 1;
+	}
+	// Promotion, as "e8=Q" or "e8Q"
+	int promotion = 0;
+	if (type == pawn && length >= 3 && strchr("NBRQ", text[length - 1])) {
+		promotion = PIECE_TYPE(ctop(text[length - 1]));
+		length -= (text[length - 2] == '=') ? 2 : 1;
+	}
+	if (length - i < 2 || text[length - 2] < 'a' || text[length - 2] > 'h' ||
+		text[length - 1] < '1' || text[length - 1] > '8')
+		return 1;
+	int end = (text[length - 1] - '1') * 8 + (text[length - 2] - 'a');
+
+	// Start file or rank, and captures marked by x (or :)
+	int file = -1, rank = -1;
+	for (; i < length - 2; i++) {
+		if (text[i] >= 'a' && text[i] <= 'h')
+			file = text[i] - 'a';
+		else if (text[i] >= '1' && text[i] <= '8')
+			rank = text[i] - '1';
+		else if (text[i] != 'x' && text[i] != ':' && text[i] != '-')
+			return 1;
+	}
+
+	int found = 0;
+	for (int j = 0; j < l.count; j++) {
+		move o = l.moves[j];
+		int start = MOVE_START(o);
+		if (MOVE_END(o) != end || PIECE_TYPE(g->board[start]) != type || MOVE_PROMOTION(o) != promotion)
+			continue;
+		if ((file != -1 && start % 8 != file) || (rank != -1 && start / 8 != rank))
+			continue;
+		*m = o;
+		found++;
+	}
+	return found != 1;
+}
+
+// Finds the legal move written in coordinate (e.g. "e7e8q") or standard
+//   algebraic notation (e.g. "e8=Q+"), returns 1 if there is none
+int parse_move(game* g, char* text, move* m) {
+	int length = move_text_length(text);
+	if (length == 0)
+		return 1;
+
+	// Coordinate notation is always 4 or 5 characters starting with a tile
+	if ((length == 4 || length == 5) && text[1] >= '1' && text[1] <= '8') {
+		move_list l;
+		get_moves(g, COL_I(g->turn), &l);
+		char notation[6];
+		for (int i = 0; i < l.count; i++) {
+			move_notation(l.moves[i], notation);
+			if (strlen(notation) == length && strncmp(notation, text, length) == 0) {
+				*m = l.moves[i];
+				return 0;
 			}
 		}
 	}
+	return parse_san(g, text, length, m);
 }
@@ -3,8 +3,34 @@
 // Copyright (C) 2021 Theo Henson.
 // Released under the GPL v3.0, see LICENSE.
 
+#include <stdio.h>
+
 #define GAME_FEN "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR"
 #define PROMPT_LEN 256
+// Longest FEN (and a bit extra), and longest move in algebraic notation (e.g. "exd8=Q#")
+#define FEN_LEN 100
+#define SAN_LEN 8
+// Longest token read from a PGN file, longer ones are cut short
+#define PGN_TOKEN_LEN 256
+// Longest line read from an EPD file, longer ones are skipped
+#define EPD_LINE_LEN 4096
+// Upper bound on the moves in any position (the known maximum is 218)
+#define MAX_MOVES 256
+// Capacity of the undo stack; games are limited to GAME_PLY_LIMIT so that
+//   perft and search always have room to play moves on top of them
+#define MAX_GAME_PLY 2048
+#define GAME_PLY_LIMIT (MAX_GAME_PLY - 256)
+// Transposition table entries per bucket (one 64 byte cache line)
+#define TT_BUCKET_SIZE 4
+// Search depth limit, and score bounds (mate scores count down by ply from MATE_SCORE)
+#define MAX_PLY 64
+#define INFINITE_SCORE 32000
+#define MATE_SCORE 30000
+#define MATE_BOUND (MATE_SCORE - MAX_PLY)
+// Most pieces of one color on the board
+#define MAX_PIECES 16
+// Most search threads
+#define MAX_THREADS 256
 #define PIECE_TYPE(piece) (piece & ~(white | black))
 #define PIECE_COLOR(piece) (piece & ~(pawn | knight | bishop | rook | queen | king))
 #define PIECE_OCOLOR(piece) ((PIECE_COLOR(piece) == white) ? black : white)
@@ -19,16 +45,19 @@
 // The index for arrays pertaining to the color of a piece
 #define COL_I(piece) ((PIECE_COLOR(piece) == white) ? 0 : 1)
 
-// Appends an item to a linked list, initializing if necessary
-#define APPEND_LIST(tail, head, add) { \
-		if (tail) { \
-			tail->next = add; \
-			tail = add; \
-		} else { \
-			head = add; \
-			tail = add; \
-		} \
-	}
+// Castling rights bit for a color index and side (1 is h, 0 is a)
+#define CASTLE_RIGHT(c, side) (1 << ((c) * 2 + (side)))
+#define ALL_CASTLE_RIGHTS 15
+
+// A material signature holds the number of pieces of each color index and type in 4 bits
+#define MATERIAL_ONE(c, type) (1ULL << (((c) * 6 + (type)) * 4))
+#define MATERIAL_COUNT(material, c, type) ((int)(((material) >> (((c) * 6 + (type)) * 4)) & 15))
+
+// Bitboard helpers; bit n of a bitboard is tile n (a1 = 0, h8 = 63)
+#define BIT(tile) (1ULL << (tile))
+#define POPCOUNT(bb) __builtin_popcountll(bb)
+#define LSB(bb) __builtin_ctzll(bb)
+#define MSB(bb) (63 - __builtin_clzll(bb))
 
 enum {
 	black = 8,
@@ -44,57 +73,391 @@ enum {
 	king = 5
 } typedef piece_type;
 
+// Relation of a stored score to the true score (never none in a stored entry)
+enum {
+	bound_none,
+	bound_upper,
+	bound_lower,
+	bound_exact
+} typedef tt_bound;
+
 enum {
 	not_finished,
 	by_checkmate,
 	by_stalemate,
 	by_repetition,
-	by_fifty_move
+	by_fifty_move,
+	by_insufficient_material
 } typedef end_condition;
 
-struct move {
-	int start;
-	int end;
+// Hot paths counted by the instrumentation (built with make INSTRUMENT=1):
+//   legal move generation of each piece type, then single functions
+enum {
+	stat_pawn_moves,
+	stat_knight_moves,
+	stat_bishop_moves,
+	stat_rook_moves,
+	stat_queen_moves,
+	stat_king_moves,
+	stat_filter_legal_moves,
+	stat_make_move,
+	stat_undo_move,
+	stat_tile_attacked,
+	// Moves appended to move lists (which are fixed buffers, so nothing is allocated)
+	stat_new_move,
+	stat_count
+} typedef stat_kind;
+
+// Calls of each hot path and the clock ticks spent in them (including nested calls)
+struct {
+	unsigned long long calls[stat_count];
+	unsigned long long ticks[stat_count];
+} typedef stats_counters;
+
+// Each thread counts into its own counters, so threads don't contend for them;
+//   the clock is the cycle counter where there is one, else time_ns
+#ifdef INSTRUMENT
+#if defined(__x86_64__) || defined(__i386__)
+#define STATS_CLOCK() __builtin_ia32_rdtsc()
+#define STATS_UNIT "cycles"
+#else
+#define STATS_CLOCK() time_ns()
+#define STATS_UNIT "ns"
+#endif
+#define STATS_START() unsigned long long stats_start = STATS_CLOCK()
+#define STATS_END(kind) (stats_local.calls[kind]++, stats_local.ticks[kind] += STATS_CLOCK() - stats_start)
+#define STATS_COUNT(kind) (stats_local.calls[kind]++)
+#else
+#define STATS_START()
+#define STATS_END(kind)
+#define STATS_COUNT(kind)
+#endif
+
+// How the benchmark prints its results
+enum {
+	bench_text,
+	bench_csv,
+	bench_json
+} typedef bench_format;
+
+// What the engine prints while it searches
+enum {
+	output_none,
+	// Each finished iteration
+	output_text,
+	// Each finished iteration as a UCI info line
+	output_uci
+} typedef search_output;
+
+// Kinds of move, stored in the top four bits of a move
+enum {
+	flag_quiet,
+	flag_double_push,
+	flag_castle_right,
+	flag_castle_left,
+	flag_capture,
+	flag_en_passant,
+	// Promotions to a knight, bishop, rook or queen (plus flag_capture when capturing)
+	flag_promotion = 8
+} typedef move_flag;
+
+// A move packed into 16 bits: start tile, end tile and a move_flag; anything
+//   else needed to revoke it is kept on the undo stack
+typedef unsigned short move;
+#define MOVE(start, end, flag) ((move)((start) | ((end) << 6) | ((flag) << 12)))
+#define MOVE_START(m) ((m) & 63)
+#define MOVE_END(m) (((m) >> 6) & 63)
+#define MOVE_FLAG(m) ((m) >> 12)
+#define MOVE_CAPTURE(m) (MOVE_FLAG(m) & flag_capture)
+// Piece type a pawn promotes to, or 0
+#define MOVE_PROMOTION(m) ((MOVE_FLAG(m) & flag_promotion) ? (MOVE_FLAG(m) & 3) + knight : 0)
+// Stands for no move, as a1 to a1 can't be played
+#define NO_MOVE 0
+
+// Fixed capacity move buffer, filled in place by the move generator
+struct {
+	move moves[MAX_MOVES];
+	int count;
+} typedef move_list;
+
+typedef unsigned long long bitboard;
+
+// State needed to revoke a move, one per ply on the undo stack
+struct {
+	move m;
+	// Captured piece and its tile (which differs from the end tile for en passant)
 	int captured;
-	int promotion;
+	int captured_tile;
+	int castle_rights;
 	int en_passant;
-	int castle;
-	struct move* next;
-};
-typedef struct move move;
+	int halfmove_clock;
+	// Hash of the position before the move
+	unsigned long long hash;
+} typedef undo_record;
+
+// A transposition table entry; data packs the move, score, bound, age and depth,
+//   or a node count for perft, and key is the position hash xor data
+struct {
+	unsigned long long key;
+	unsigned long long data;
+} typedef tt_entry;
 
-struct piece_list {
-	int tile;
-	struct piece_list* next;
-};
-typedef struct piece_list piece_list;
+struct {
+	tt_entry entries[TT_BUCKET_SIZE];
+} __attribute__((aligned(64))) typedef tt_bucket;
+
+struct {
+	unsigned long long probes;
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long stores;
+	// Stores that replaced an entry for a different position
+	unsigned long long collisions;
+	// Lookups in the pawn structure table of eval.c
+	unsigned long long pawn_probes;
+	unsigned long long pawn_hits;
+} typedef tt_stats;
 
 struct {
 	piece_color turn;
 	int board[64];
-	piece_list* pieces[2];
+	// One bitboard per color index and piece type, plus per color occupancy
+	bitboard bitboards[2][6];
+	bitboard occupancy[2];
+	// Tiles of each color's pieces packed at the front of an array, and
+	//   each occupied tile's index into its color's array
+	int pieces[2][MAX_PIECES];
+	int piece_count[2];
+	int piece_index[64];
 	int king_tiles[2];
-	int king_moved[2];
-	int rook_moved[2][2];
-// TODO: keep track of
-// int queen_count[2]:
-// int bishop_count[2]:
-// int rook_count[2]:
-	move* moves_head;
-	move* moves_tail;
+	int castle_rights;
+	// Tile a pawn skipped over with a two tile push on the last move, or -1
+	//   (only set if an enemy pawn could capture there)
+	int en_passant;
+	// Plies since the last capture or pawn move
+	int halfmove_clock;
+	// Number of the current full move, counting up after each black move
+	int fullmove;
+	// Zobrist hash of the position, kept up to date by make_move and undo_move,
+	//   and the hash of just its pawns
+	unsigned long long hash;
+	unsigned long long pawn_hash;
+	// Material signature, and the sum of the middlegame and endgame piece-square
+	//   scores of all pieces (from white's side), kept up to date like the hash
+	unsigned long long material;
+	int mg_score;
+	int eg_score;
+	undo_record history[MAX_GAME_PLY];
+	int ply;
 	end_condition ended;
 } typedef game;
 
+// What reading a PGN file has reached
+enum {
+	// End of the file
+	pgn_done,
+	// The start of a game, set up in the game passed in
+	pgn_game,
+	// A move, made on the game passed in
+	pgn_move
+} typedef pgn_event;
+
+// State of a PGN file being read one token at a time
+struct {
+	FILE* f;
+	int line;
+	// Whether the previous character ended a line (for % escapes)
+	int line_start;
+	// Between games (0), reading a game's moves (1), or skipping a bad game (2)
+	int state;
+	// FEN tag of the next game, empty for the standard starting position
+	char fen[FEN_LEN];
+	// Token read ahead while starting a game
+	char token[PGN_TOKEN_LEN];
+	int held;
+	unsigned long long games;
+	unsigned long long moves;
+	unsigned long long errors;
+} typedef pgn_reader;
+
+// What reading an EPD file has reached
+enum {
+	// End of the file
+	epd_done,
+	// A position, set up in the game passed in
+	epd_position,
+	// A line too long to hold, skipped
+	epd_long_line,
+	// A line without a readable position, skipped
+	epd_bad_position
+} typedef epd_event;
+
+// State of an EPD file being read one line at a time
+struct {
+	FILE* f;
+	// Number of the line last read
+	int line;
+	char text[EPD_LINE_LEN];
+	// Operations of the last position read (the rest of its line)
+	char* operations;
+} typedef epd_reader;
+
+// Limits on a search; 0 means no limit
+struct {
+	int depth;
+	unsigned long long time_ms;
+	unsigned long long nodes;
+	// Flags set from another thread, read with relaxed atomics: stop ends the
+	//   search, and while ponder is set the limits don't count yet (either may be NULL)
+	int* stop;
+	int* ponder;
+} typedef search_limits;
+
+// State of a running search, one per thread
+struct searcher {
+	// Thread number, thread 0 reports progress and checks limits
+	int id;
+	// All threads of the search (sharing the node count), and the flag that ends
+	//   it; both are read by other threads, only with relaxed atomics
+	struct searcher* group;
+	int group_size;
+	int* stopped;
+	// The thread's own copy of the game
+	game* g;
+	search_limits limits;
+	unsigned long long nodes;
+	unsigned long long start_time;
+	// When the time limit started counting (later than start_time after pondering)
+	unsigned long long clock_start;
+	// Triangular principal variation table, row ply holds the line from that ply
+	move pv[MAX_PLY][MAX_PLY];
+	int pv_length[MAX_PLY];
+	// Two quiet moves per ply that last caused a cutoff, and how much each
+	//   quiet move has caused cutoffs for each color index (by start and end tile)
+	move killers[MAX_PLY][2];
+	int history[2][64][64];
+	// Beta cutoffs, and those by the first move searched (to judge move ordering)
+	unsigned long long cutoffs;
+	unsigned long long first_move_cutoffs;
+	// Transposition table counters of the thread, collected when it finishes
+	tt_stats tt_counters;
+	// Depth, score and first two moves of the PV of the last finished iteration
+	//   (kept by thread 0; ponder is NO_MOVE if the PV has one move)
+	int depth;
+	int score;
+	move best;
+	move ponder;
+} typedef searcher;
+
 // io.c
 int promotion_prompt();
-void play(game*);
+void play(game*, int[2], search_limits*);
+
+// uci.c
+void uci(game*, int);
+
+// epd.c
+void epd_open(FILE*, epd_reader*);
+epd_event epd_next(epd_reader*, game*);
+int epd_run(char*, int, search_limits*);
+
+// analyze.c
+int analyze_run(char*, search_limits*);
+
+// pgn.c
+void pgn_open(FILE*, pgn_reader*);
+pgn_event pgn_next(pgn_reader*, game*);
+int pgn_run(char*);
+void pgn_write(game*, FILE*);
+void pgn_write_moves(game*, FILE*);
+
+// bench.c
+unsigned long long bench_run(bench_format);
+
+// book.c
+unsigned long long book_key(game*);
+int book_open(char*);
+void book_close();
+int book_loaded();
+int book_moves(game*, move[MAX_MOVES], int[MAX_MOVES]);
+int book_probe(game*, move*);
+int book_check_keys();
+
+// eval.c
+extern const int piece_values[6];
+extern int mg_table[2][6][64];
+extern int eg_table[2][6][64];
+void compute_eval_tables();
+void score_position(game*);
+int insufficient_material(game*);
+int evaluate(game*);
 
 // fen.c
-void load_fen(char*, game*);
+int load_fen(char*, game*);
+void write_fen(game*, char[FEN_LEN]);
+void move_san(game*, move, char[SAN_LEN]);
+int parse_move(game*, char*, move*);
+void move_notation(move, char[6]);
 char ptoc(int);
 int ctop(char);
 
 // moves.c
 void compute_move_data();
-void make_move(game*, move*);
-move* get_piece_moves(game*, int);
+void make_move(game*, move);
+void undo_move(game*);
+int in_check(game*);
+int see(game*, move);
+void get_piece_moves(game*, int, move_list*);
+void get_moves(game*, int, move_list*);
+void get_captures(game*, int, move_list*);
+void get_moves_filtered(game*, int, move_list*);
+
+// zobrist.c
+extern unsigned long long zobrist_pieces[2][6][64];
+extern unsigned long long zobrist_castle[16];
+extern unsigned long long zobrist_en_passant[8];
+extern unsigned long long zobrist_turn;
+void compute_zobrist_keys();
+unsigned long long hash_position(game*);
+unsigned long long hash_pawns(game*);
+int repetitions(game*);
+
+// tt.c
+extern __thread tt_stats tt_counters;
+int tt_resize(int);
+int tt_size();
+void tt_clear();
+void tt_add_stats(tt_stats*);
+void tt_new_search();
+int tt_probe(unsigned long long, int*, int*, int*, int*);
+void tt_store(unsigned long long, int, int, int, int);
+int tt_probe_perft(unsigned long long, int, unsigned long long*);
+void tt_store_perft(unsigned long long, int, unsigned long long);
+void tt_print_stats();
+
+// perft.c
+unsigned long long perft(game*, int);
+unsigned long long perft_divide(game*, int, int);
+unsigned long long perft_parallel(game*, int, int, int);
+unsigned long long perft_verify(game*, int, unsigned long long*);
+int perft_suite(int);
+
+// search.c
+int search_set_threads(int);
+int search_threads();
+void search_set_output(search_output);
+unsigned long long search_nodes();
+int search_ponder_move(move*);
+int search(game*, search_limits*, move*);
+int search_alone(searcher*, game*, search_limits*);
+void search_scaling(game*, search_limits*);
+
+// stats.c
+extern __thread stats_counters stats_local;
+int stats_enabled();
+void stats_flush();
+void stats_reset();
+void stats_print();
+
+// timer.c
+unsigned long long time_ns();
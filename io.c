@@ -27,17 +27,8 @@ static int notation_to_tile(char notation[2]) {
 	return rank * 8 + file;
 }
 
-// Returns the notation of a tile index
-static char* tile_to_notation(int tile) {
-	int file = tile % 8;
-	int rank = tile / 8;
-	char* notation = malloc(3);
-	sprintf(notation, "%c%c", 'a' + file, '1' + rank);
-	return notation;
-}
-
 // Prints the board with move highlights
-void render_board(int board[64], move* m) {
+void render_board(int board[64], move_list* l) {
 	char board_buffer[8][17];
 	int rank = 7;
 	int file = 0;
@@ -53,16 +44,16 @@ void render_board(int board[64], move* m) {
 	}
 
 	// Highlight moves
-	while (m) {
-		rank = 7 - (m->end / 8);
-		file = (m->end % 8) * 2;
-		if (board[m->end] != 0)
+	for (int i = 0; l && i < l->count; i++) {
+		move m = l->moves[i];
+		rank = 7 - (MOVE_END(m) / 8);
+		file = (MOVE_END(m) % 8) * 2;
+		if (board[MOVE_END(m)] != 0)
 			board_buffer[rank][file] = 'x';
-		else if (m->en_passant)
+		else if (MOVE_FLAG(m) == flag_en_passant)
 			board_buffer[rank][file] = 'x';
 		else
 			board_buffer[rank][file] = '*';
-		m = m->next;
 	}
 
 	printf("\n   a b c d e f g h\n\n");
@@ -78,7 +69,11 @@ int promotion_prompt() {
 	int piece;
 	while (1) {
 		command = readline("choose promotion (q/b/n/r) : ");
-		if (command && *command)
+		if (!command) {
+			printf("\n");
+			exit(0);
+		}
+		if (*command)
 			add_history(command);
 		if (strlen(command) != 1) {
 			printf("bad promotion\n");
@@ -93,8 +88,57 @@ int promotion_prompt() {
 	}
 }
 
+// Parses search limits such as "5s", "500ms", "depth 6" or "6" (a depth),
+//   keeping the defaults when empty; returns 1 if they are invalid
+static int parse_limits(char* args, search_limits* limits) {
+	while (*args == ' ')
+		args++;
+	if (!*args)
+		return 0;
+
+	char* end;
+	if (strncmp(args, "depth ", 6) == 0) {
+		args += 6;
+		limits->depth = (int)strtol(args, &end, 10);
+		limits->time_ms = 0;
+		return (end == args || *end || limits->depth < 1);
+	}
+
+	long long value = strtoll(args, &end, 10);
+	if (end == args || value < 1)
+		return 1;
+	if (strcmp(end, "s") == 0) {
+		limits->time_ms = value * 1000;
+		limits->depth = 0;
+	} else if (strcmp(end, "ms") == 0) {
+		limits->time_ms = value;
+		limits->depth = 0;
+	} else if (*end == '\0') {
+		limits->depth = (int)value;
+		limits->time_ms = 0;
+	} else {
+		return 1;
+	}
+	return 0;
+}
+
+// Lets the engine choose and make a move, from the book if it has one,
+//   returns 0 if there are no moves
+static int engine_move(game* g, search_limits* limits) {
+	move best;
+	int from_book = book_probe(g, &best);
+	if (!from_book && !search(g, limits, &best))
+		return 0;
+
+	char notation[6];
+	move_notation(best, notation);
+	printf("engine plays %s%s\n", notation, from_book ? " (book)" : "");
+	make_move(g, best);
+	return 1;
+}
+
 // Creates a read-evaluate-print loop until a move is made
-void repl(game* g) {
+void repl(game* g, search_limits* limits) {
 	int selected_tile = -1;
 	char prompt[PROMPT_LEN];
 	sprintf(prompt, "%s to move : ", (g->turn == white) ? "WHITE" : "black");
@@ -102,12 +146,176 @@ void repl(game* g) {
 	// Repeat until move is chosen
 	while (1) {
 		char* command = readline(prompt);
-		if (command && *command)
+		if (!command) {
+			printf("\n");
+			exit(0);
+		}
+		if (*command)
 			add_history(command);
 
+		// Let the engine move for the side to play
+		if (strcmp(command, "go") == 0 || strncmp(command, "go ", 3) == 0) {
+			search_limits go_limits = *limits;
+			if (parse_limits(command + 2, &go_limits)) {
+				printf("bad limits\n");
+				continue;
+			}
+			if (g->ply >= GAME_PLY_LIMIT) {
+				printf("move history full\n");
+				continue;
+			}
+			if (engine_move(g, &go_limits))
+				return;
+			printf("no moves\n");
+			continue;
+		}
+
+		// Resize the transposition table, or show its counters
+		if (strcmp(command, "hash") == 0) {
+			tt_print_stats();
+			continue;
+		}
+		if (strncmp(command, "hash ", 5) == 0) {
+			int mb = atoi(command + 5);
+			if (mb < 0 || tt_resize(mb)) {
+				printf("bad hash size\n");
+				continue;
+			}
+			printf("hash: %d MB\n", tt_size());
+			continue;
+		}
+
+		// Show the book moves of the position
+		if (strcmp(command, "book") == 0) {
+			move moves[MAX_MOVES];
+			int weights[MAX_MOVES];
+			int count = book_moves(g, moves, weights);
+			int total = 0;
+			for (int i = 0; i < count; i++)
+				total += weights[i];
+			char san[SAN_LEN];
+			for (int i = 0; i < count; i++) {
+				move_san(g, moves[i], san);
+				printf("%s %d (%.1f%%)\n", san, weights[i], total ? weights[i] * 100.0 / total : 0.0);
+			}
+			if (count == 0)
+				printf(book_loaded() ? "no book moves\n" : "no book\n");
+			continue;
+		}
+
+		// Show or clear the hot path counters
+		if (strcmp(command, "stats") == 0) {
+			stats_print();
+			continue;
+		}
+		if (strcmp(command, "stats reset") == 0) {
+			stats_reset();
+			continue;
+		}
+
+		// Set or show the number of search threads
+		if (strcmp(command, "threads") == 0) {
+			printf("threads: %d\n", search_threads());
+			continue;
+		}
+		if (strncmp(command, "threads ", 8) == 0) {
+			if (search_set_threads(atoi(command + 8))) {
+				printf("bad thread count\n");
+				continue;
+			}
+			printf("threads: %d\n", search_threads());
+			continue;
+		}
+
+		// Compare search speed with 1, 2, 4 ... threads
+		if (strcmp(command, "scaling") == 0 || strncmp(command, "scaling ", 8) == 0) {
+			search_limits scaling_limits = *limits;
+			if (parse_limits(command + 7, &scaling_limits)) {
+				printf("bad limits\n");
+				continue;
+			}
+			search_scaling(g, &scaling_limits);
+			continue;
+		}
+
+		// Switch to talking to a chess GUI
+		if (strcmp(command, "uci") == 0)
+			uci(g, 1);
+
+		// Show the position, or set up another one
+		if (strcmp(command, "fen") == 0) {
+			char fen[FEN_LEN];
+			write_fen(g, fen);
+			printf("%s\n", fen);
+			continue;
+		}
+		if (strncmp(command, "fen ", 4) == 0) {
+			game* fg = malloc(sizeof(game));
+			if (!fg || load_fen(command + 4, fg)) {
+				printf("bad fen\n");
+				free(fg);
+				continue;
+			}
+			*g = *fg;
+			free(fg);
+			return;
+		}
+
+		// Write the game so far as PGN, to standard output or a file
+		if (strcmp(command, "pgn") == 0) {
+			pgn_write(g, stdout);
+			continue;
+		}
+		if (strncmp(command, "pgn ", 4) == 0) {
+			FILE* f = fopen(command + 4, "w");
+			if (!f) {
+				printf("could not open %s\n", command + 4);
+				continue;
+			}
+			pgn_write(g, f);
+			fclose(f);
+			continue;
+		}
+
+		// Time the hot paths over a fixed set of positions
+		if (strcmp(command, "bench") == 0 || strcmp(command, "bench text") == 0) {
+			bench_run(bench_text);
+			continue;
+		}
+		if (strcmp(command, "bench csv") == 0) {
+			bench_run(bench_csv);
+			continue;
+		}
+		if (strcmp(command, "bench json") == 0) {
+			bench_run(bench_json);
+			continue;
+		}
+
+		// Count move tree nodes, either from here or from a given FEN, on the search threads
+		if (strncmp(command, "perft ", 6) == 0) {
+			char* fen = NULL;
+			int depth = (int)strtol(command + 6, &fen, 10);
+			while (*fen == ' ')
+				fen++;
+			if (depth < 1) {
+				printf("bad depth\n");
+				continue;
+			}
+			if (*fen) {
+				game pg;
+				if (load_fen(fen, &pg)) {
+					printf("bad fen\n");
+					continue;
+				}
+				perft_parallel(&pg, depth, search_threads(), 1);
+			} else {
+				perft_parallel(g, depth, search_threads(), 1);
+			}
+			continue;
+		}
+
 		// One character commands
 		if (strlen(command) == 1) {
-			move* m = g->moves_head;
 			switch (command[0]) {
 				// Render board
 				case 'b':
@@ -119,29 +327,12 @@ void repl(game* g) {
 					sprintf(prompt, "%s to move : ", (g->turn == white) ? "WHITE" : "black");
 					continue;
 				// Move history
-				case 'm': ;
-					int i = 1;
-					while (m) {
-						printf("%d. %s%s", i, tile_to_notation(m->start), tile_to_notation(m->end));
-						m = m->next;
-						if (m) {
-							printf(" %s%s\n", tile_to_notation(m->start), tile_to_notation(m->end));
-							m = m->next;
-						} else {
-							printf("\n");
-							break;
-						}
-						i++;
-					}
+				case 'm':
+					pgn_write_moves(g, stdout);
 					continue;
 				// Quit
 				case 'q':
 					printf("quitting...\n");
-					while (m) {
-						move* om = m;
-						m = m->next;
-						free(om);
-					}
 					exit(0);
 					continue;
 			}
@@ -160,25 +351,21 @@ void repl(game* g) {
 				continue;
 			}
 				
-			move* m = get_piece_moves(g, selected_tile);
-			if (!m) {
+			move_list l;
+			get_piece_moves(g, selected_tile, &l);
+			if (l.count == 0) {
 				printf("piece has no moves\n");
 				selected_tile = -1;
 				continue;
 			}
 
 			sprintf(prompt, "%s to move (%s) : ", (g->turn == white) ? "WHITE" : "black", command);
-			render_board(g->board, m);
-			while (m) {
-				move* om = m;
-				m = m->next;
-				free(om);
-			}
+			render_board(g->board, &l);
 			continue;
 		}
 
-		// Move is made
-		if (strlen(command) == 4) {
+		// Move is made, optionally naming the promotion piece (e.g. "e7e8q")
+		if (strlen(command) == 4 || strlen(command) == 5) {
 
 			// Get piece moves
 			char start[2] = {command[0], command[1]};
@@ -193,28 +380,32 @@ void repl(game* g) {
 				printf("bad source tile\n");
 				continue;
 			}
-			move* m = get_piece_moves(g, start_tile);
-
-			// Check input move and make it
-			while (m) {
-				if (m->end == end_tile) {
-					make_move(g, m);
-
-					// For castling
-					// Track kings
-					int piece = g->board[m->end];
-					if (PIECE_TYPE(piece) == king) {
-						g->king_moved[COL_I(piece)] = 1;
-					} else if (PIECE_TYPE(piece) == rook) {
-						// Track rooks for castling (second array, 1 is h, 0 is a)
-						g->rook_moved[COL_I(piece)][m->start % 8 == 7 ? 1 : 0] = 1;
-					}
+			if (g->ply >= GAME_PLY_LIMIT) {
+				printf("move history full\n");
+				continue;
+			}
+			move_list l;
+			get_piece_moves(g, start_tile, &l);
 
+			// Check input move and make it (asking which piece for promotions if not given)
+			int promotion = 0;
+			if (command[4]) {
+				int piece = ctop(command[4]);
+				promotion = PIECE_TYPE(piece);
+				if (!piece || promotion == pawn || promotion == king) {
+					printf("bad promotion\n");
+					continue;
+				}
+			}
+			for (int i = 0; i < l.count; i++) {
+				if (MOVE_END(l.moves[i]) != end_tile)
+					continue;
+				if (MOVE_PROMOTION(l.moves[i]) && !promotion)
+					promotion = PIECE_TYPE(promotion_prompt());
+				if (MOVE_PROMOTION(l.moves[i]) == promotion) {
+					make_move(g, l.moves[i]);
 					return;
 				}
-				move* om = m;
-				m = m->next;
-				free(om);
 			}
 			printf("bad move\n");
 			continue;
@@ -223,14 +414,27 @@ void repl(game* g) {
 	}
 }
 
-// Starts the game
-void play(game* g) {
+// Starts the game, with the engine playing the color indexes set in engine
+void play(game* g, int engine[2], search_limits* limits) {
 
 	// Take commands
 	while (g->ended == not_finished) {
 		render_board(g->board, NULL);
-		repl(g);
-		g->turn = (g->turn == white) ? black : white;
+		if (engine[COL_I(g->turn)] && g->ply < GAME_PLY_LIMIT)
+			engine_move(g, limits);
+		else
+			repl(g, limits);
+
+		move_list l;
+		get_moves(g, COL_I(g->turn), &l);
+		if (l.count == 0)
+			g->ended = in_check(g) ? by_checkmate : by_stalemate;
+		else if (repetitions(g) >= 2)
+			g->ended = by_repetition;
+		else if (g->halfmove_clock >= 100)
+			g->ended = by_fifty_move;
+		else if (insufficient_material(g))
+			g->ended = by_insufficient_material;
 	}
 
 	// Handle endings
@@ -247,6 +451,9 @@ void play(game* g) {
 		case by_fifty_move:
 			printf("game ended: %s\n", "draw by fifty-move rule");
 			break;
+		case by_insufficient_material:
+			printf("game ended: %s\n", "draw by insufficient material");
+			break;
 		default:
 			break;
 	}
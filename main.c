@@ -3,23 +3,117 @@
 // Released under the GPL v3.0, see LICENSE.
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
 
 #include "game.h"
 
+static void usage() {
+	fprintf(stderr, "usage: chess [-w] [-b] [-t seconds] [-d depth] [-n nodes] [-H mb] [-T threads] [-B book] [-f fen | -e epd | -p pgn | -a file | -u]\n");
+	exit(2);
+}
+
 int main(int argc, char* argv[]) {
+	// Engine settings; by default it plays neither side and thinks for 5 seconds
+	int engine[2] = { 0, 0 };
+	search_limits limits = { .depth = 0, .time_ms = 5000, .nodes = 0 };
+	int hash_mb = 16;
+	char* fen = GAME_FEN;
+	char* epd = NULL;
+	char* pgn = NULL;
+	char* analyze = NULL;
+	char* book = NULL;
+	int uci_mode = 0;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "wbt:d:n:H:T:B:f:e:p:a:u")) != -1) {
+		switch (opt) {
+			case 'w':
+				engine[0] = 1;
+				break;
+			case 'b':
+				engine[1] = 1;
+				break;
+			case 't':
+				limits.time_ms = (unsigned long long)(atof(optarg) * 1000);
+				limits.depth = 0;
+				break;
+			case 'd':
+				limits.depth = atoi(optarg);
+				limits.time_ms = 0;
+				break;
+			case 'n':
+				limits.nodes = strtoull(optarg, NULL, 10);
+				limits.time_ms = 0;
+				break;
+			case 'H':
+				hash_mb = atoi(optarg);
+				break;
+			case 'f':
+				fen = optarg;
+				break;
+			case 'e':
+				epd = optarg;
+				break;
+			case 'p':
+				pgn = optarg;
+				break;
+			case 'a':
+				analyze = optarg;
+				break;
+			case 'B':
+				book = optarg;
+				break;
+			case 'u':
+				uci_mode = 1;
+				break;
+			case 'T':
+				if (search_set_threads(atoi(optarg)))
+					usage();
+				break;
+			default:
+				usage();
+		}
+	}
+	if (tt_resize(hash_mb)) {
+		fprintf(stderr, "chess: could not allocate hash table\n");
+		return 1;
+	}
+
 	compute_move_data();
+	if (stats_enabled())
+		atexit(stats_print);
+	if (book && book_open(book)) {
+		fprintf(stderr, "chess: could not open book %s\n", book);
+		return 1;
+	}
+	if (epd)
+		return epd_run(epd, 0, &limits) ? 1 : 0;
+	if (pgn)
+		return pgn_run(pgn) ? 1 : 0;
+	if (analyze)
+		return analyze_run(analyze, &limits) ? 1 : 0;
 	game ng = {
 		.turn = white,
 		.board = { 0 },
+		.bitboards = { { 0 }, { 0 } },
+		.occupancy = { 0, 0 },
 		.king_tiles = { 0, 0 },
-		.king_moved = {0, 0},
-		.rook_moved = { {0, 0}, {0, 0} },
-		.pieces = { NULL, NULL },
-		.moves_head = NULL,
-		.moves_tail = NULL,
+		.castle_rights = ALL_CASTLE_RIGHTS,
+		.en_passant = -1,
+		.halfmove_clock = 0,
+		.fullmove = 1,
+		.hash = 0,
+		.piece_count = { 0, 0 },
+		.ply = 0,
 		.ended = not_finished
 	};
 	game *g = &ng;
-	load_fen(GAME_FEN, g);
-	play(g);
+	if (load_fen(fen, g)) {
+		fprintf(stderr, "chess: bad fen\n");
+		return 1;
+	}
+	if (uci_mode)
+		uci(g, 0);
+	play(g, engine, &limits);
 }
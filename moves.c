@@ -16,9 +16,27 @@ static const int pawn_locations[2][4] = { { 1, 6, 8, 3 }, { 6, 1, -8, 4 } };
 
 // Stores information about valid moves
 int tiles_from_edge[64][8];
-int knight_jumps[64][8];
-int king_moves[64][8];
-int king_distances[64][64];
+bitboard knight_attacks[64];
+bitboard king_attacks[64];
+bitboard pawn_attacks[2][64];
+// Tiles along each direction up to the edge of the board (not including the tile)
+bitboard rays[64][8];
+// Castling rights that remain after a move to or from each tile
+int castle_masks[64];
+// For two tiles on a line, the tiles strictly between them and the whole line through them
+static bitboard between[64][64];
+static bitboard lines[64][64];
+
+// What is needed to only generate legal moves, worked out once per position
+struct {
+	// Enemy pieces giving check
+	bitboard checkers;
+	// Own pieces that would expose the king to a slider if they left its line
+	bitboard pinned;
+	// Tiles pieces other than the king can move to: anywhere, or when
+	//   in check the checker and the tiles between it and the king
+	bitboard evasions;
+} typedef legality;
 
 // Branchless maximum function
 static int max(int a, int b) {
@@ -34,183 +52,300 @@ static int min(int a, int b) {
 	return b + (diff & dsgn);
 }
 
-// Returns whether a move was a double pawn push
-static int two_pawn_push(move* m, int board[64]) {
-	if (m) {
-		int piece = board[m->end];
-		int c = COL_I(piece);
-		if ((m->start / 8 == pawn_locations[c][0]) &&
-			(m->end / 8 == pawn_locations[c][3])) {
-			return 1;
-		}
-	}
-	return 0;
-}
-
-// Delete an item from a piece_list based on its tile value
-static piece_list* del_piece(piece_list* head, int tile) {
-	piece_list* p = head;
-	piece_list* last = NULL;
-	while (p) {
-		if (p->tile == tile) {
-			if (last)  {
-				last->next = p->next;
-				break;
-			} else
-				return p->next;
+// Returns the tiles attacked along directions di_start up to di_end,
+//   stopping each ray at the first occupied tile
+static bitboard sliding_attacks(int tile, bitboard occupied, int di_start, int di_end) {
+	bitboard attacks = 0;
+	for (int di = di_start; di < di_end; di++) {
+		bitboard ray = rays[tile][di];
+		bitboard blockers = ray & occupied;
+		if (blockers) {
+			// Positive directions run towards h8, so the nearest blocker is the lowest bit
+			int blocker = (directions[di] > 0) ? LSB(blockers) : MSB(blockers);
+			ray ^= rays[blocker][di];
 		}
-		last = p;
-		p = p->next;
+		attacks |= ray;
 	}
-	return head;
+	return attacks;
 }
 
-// Returns whether a tile is under attack by the opponent color
-//   Technically not general, as doesn't include en passant attacks; meant for king
-static int tile_attacked(game* g, int tile) {
+#define ROOK_ATTACKS(tile, occupied) sliding_attacks(tile, occupied, 0, 4)
+#define BISHOP_ATTACKS(tile, occupied) sliding_attacks(tile, occupied, 4, 8)
 
-	// Less dereferencing of board
-	int* board = g->board;
-
-	// King
-	if (king_distances[tile][g->king_tiles[!COL_I(g->turn)]] == 1)
-		return 1;
+// Puts a piece on an empty tile, keeping the bitboards and piece lists in sync
+static void set_tile(game* g, int tile, int piece) {
+	int c = COL_I(piece);
+	g->board[tile] = piece;
+	g->piece_index[tile] = g->piece_count[c];
+	g->pieces[c][g->piece_count[c]++] = tile;
+	g->bitboards[c][PIECE_TYPE(piece)] |= BIT(tile);
+	g->occupancy[c] |= BIT(tile);
+	g->hash ^= zobrist_pieces[c][PIECE_TYPE(piece)][tile];
+	if (PIECE_TYPE(piece) == pawn)
+		g->pawn_hash ^= zobrist_pieces[c][pawn][tile];
+	g->material += MATERIAL_ONE(c, PIECE_TYPE(piece));
+	g->mg_score += mg_table[c][PIECE_TYPE(piece)][tile];
+	g->eg_score += eg_table[c][PIECE_TYPE(piece)][tile];
+}
 
-	// Knight
-	for (int i = 0; i < 8; i++) {
-		if ((board[knight_jumps[tile][i]] == knight) && (ENEMY_COLOR(board[knight_jumps[tile][i]], g->turn)))
-			return 1;
-	}
+// Empties a tile, keeping the bitboards and piece lists in sync
+static void clear_tile(game* g, int tile) {
+	int piece = g->board[tile];
+	if (piece == 0)
+		return;
+	int c = COL_I(piece);
+	g->board[tile] = 0;
+
+	// Fill the hole in the piece list with the last piece
+	int last = g->pieces[c][--g->piece_count[c]];
+	g->pieces[c][g->piece_index[tile]] = last;
+	g->piece_index[last] = g->piece_index[tile];
+	g->bitboards[c][PIECE_TYPE(piece)] &= ~BIT(tile);
+	g->occupancy[c] &= ~BIT(tile);
+	g->hash ^= zobrist_pieces[c][PIECE_TYPE(piece)][tile];
+	if (PIECE_TYPE(piece) == pawn)
+		g->pawn_hash ^= zobrist_pieces[c][pawn][tile];
+	g->material -= MATERIAL_ONE(c, PIECE_TYPE(piece));
+	g->mg_score -= mg_table[c][PIECE_TYPE(piece)][tile];
+	g->eg_score -= eg_table[c][PIECE_TYPE(piece)][tile];
+}
 
-	// Pawn
-	for (int i = 0; i < 2; i++) {
-		if (tiles_from_edge[tile][pawn_capture_directions[COL_I(g->turn)][i]] > 0) {
-			int capture_direction = directions[pawn_capture_directions[COL_I(g->turn)][i]];
-			int destination = tile + capture_direction;
-			int occupying = board[destination];
-			if (ENEMY_COLOR(occupying, g->turn) && (PIECE_TYPE(occupying) == pawn))
-				return 1;
-		}
-	}
+// Replaces the piece on a tile with another of the same color (for promotions)
+static void change_tile(game* g, int tile, int piece) {
+	int old = g->board[tile];
+	int c = COL_I(piece);
+	g->board[tile] = piece;
+	g->bitboards[c][PIECE_TYPE(old)] &= ~BIT(tile);
+	g->bitboards[c][PIECE_TYPE(piece)] |= BIT(tile);
+	g->hash ^= zobrist_pieces[c][PIECE_TYPE(old)][tile] ^ zobrist_pieces[c][PIECE_TYPE(piece)][tile];
+	if (PIECE_TYPE(old) == pawn || PIECE_TYPE(piece) == pawn)
+		g->pawn_hash ^= zobrist_pieces[c][pawn][tile];
+	g->material += MATERIAL_ONE(c, PIECE_TYPE(piece)) - MATERIAL_ONE(c, PIECE_TYPE(old));
+	g->mg_score += mg_table[c][PIECE_TYPE(piece)][tile] - mg_table[c][PIECE_TYPE(old)][tile];
+	g->eg_score += eg_table[c][PIECE_TYPE(piece)][tile] - eg_table[c][PIECE_TYPE(old)][tile];
+}
 
-	// Sliding pieces
-	for (int di = 0; di < 8; di++) {
-		for (int i = 0; i < tiles_from_edge[tile][di]; i++) {
+// Moves a piece to an empty tile, keeping its place in the piece list
+//   (so the list is in the same order after undo_move, even while get_moves goes through it)
+static void move_tile(game* g, int start, int end) {
+	int piece = g->board[start];
+	int c = COL_I(piece);
+	bitboard change = BIT(start) | BIT(end);
+	g->board[start] = 0;
+	g->board[end] = piece;
+	g->bitboards[c][PIECE_TYPE(piece)] ^= change;
+	g->occupancy[c] ^= change;
+	g->hash ^= zobrist_pieces[c][PIECE_TYPE(piece)][start] ^ zobrist_pieces[c][PIECE_TYPE(piece)][end];
+	if (PIECE_TYPE(piece) == pawn)
+		g->pawn_hash ^= zobrist_pieces[c][pawn][start] ^ zobrist_pieces[c][pawn][end];
+	g->mg_score += mg_table[c][PIECE_TYPE(piece)][end] - mg_table[c][PIECE_TYPE(piece)][start];
+	g->eg_score += eg_table[c][PIECE_TYPE(piece)][end] - eg_table[c][PIECE_TYPE(piece)][start];
+
+	g->piece_index[end] = g->piece_index[start];
+	g->pieces[c][g->piece_index[end]] = end;
+}
 
-			int destination = tile + directions[di] * (i + 1);
-			int occupying = board[destination];
+// Returns the pieces of the opponent of color index c that attack a tile,
+//   as if the board held the given occupied tiles (en passant isn't included)
+static bitboard attackers_to(game* g, int tile, int c, bitboard occupied) {
+	bitboard* enemy = g->bitboards[!c];
+	return (knight_attacks[tile] & enemy[knight]) |
+		(king_attacks[tile] & enemy[king]) |
+		(pawn_attacks[c][tile] & enemy[pawn]) |
+		(BISHOP_ATTACKS(tile, occupied) & (enemy[bishop] | enemy[queen])) |
+		(ROOK_ATTACKS(tile, occupied) & (enemy[rook] | enemy[queen]));
+}
 
-			if (SAME_COLOR(occupying, g->turn))
-				break;
+// Returns the pieces of both colors that attack a tile, as if the board held the given occupied tiles
+static bitboard all_attackers_to(game* g, int tile, bitboard occupied) {
+	bitboard (*bb)[6] = g->bitboards;
+	return (knight_attacks[tile] & (bb[0][knight] | bb[1][knight])) |
+		(king_attacks[tile] & (bb[0][king] | bb[1][king])) |
+		(pawn_attacks[1][tile] & bb[0][pawn]) |
+		(pawn_attacks[0][tile] & bb[1][pawn]) |
+		(BISHOP_ATTACKS(tile, occupied) & (bb[0][bishop] | bb[1][bishop] | bb[0][queen] | bb[1][queen])) |
+		(ROOK_ATTACKS(tile, occupied) & (bb[0][rook] | bb[1][rook] | bb[0][queen] | bb[1][queen]));
+}
 
-			// Check if occupying piece type is consistent with direction
-			if (ENEMY_COLOR(occupying, g->turn)) {
-				switch (PIECE_TYPE(occupying)) {
-					case queen:
-						return 1;
-					case rook:
-						if (di < 4)
-							return 1;
-						break;
-					case bishop:
-						if (di > 3)
-							return 1;
-						break;
-				}
-				break;
-			}
-		}
+// Returns the material a move wins (or loses, if negative) once both sides
+//   have made every capture on its end tile that pays, least valuable piece first
+int see(game* g, move m) {
+	// A king can only capture last, so it is worth more than everything else
+	static const int values[6] = { 100, 320, 330, 500, 900, 20000 };
+	int start = MOVE_START(m);
+	int end = MOVE_END(m);
+	int c = COL_I(g->board[start]);
+	bitboard occupied = (g->occupancy[0] | g->occupancy[1]) & ~BIT(start);
+
+	// Gains of the side making each capture, assuming it is made
+	int gains[32];
+	int depth = 0;
+	if (MOVE_FLAG(m) == flag_en_passant) {
+		gains[0] = values[pawn];
+		occupied &= ~BIT(end - pawn_locations[c][2]);
+	} else {
+		gains[0] = g->board[end] ? values[PIECE_TYPE(g->board[end])] : 0;
+	}
+	int on_tile = MOVE_PROMOTION(m) ? MOVE_PROMOTION(m) : PIECE_TYPE(g->board[start]);
+	if (MOVE_PROMOTION(m))
+		gains[0] += values[on_tile] - values[pawn];
+
+	bitboard attackers = all_attackers_to(g, end, occupied) & occupied;
+	int side = !c;
+	while (depth < 31) {
+		// Least valuable attacker of the side to capture
+		int type;
+		bitboard from = 0;
+		for (type = pawn; type <= king && !from; type++)
+			from = attackers & g->bitboards[side][type];
+		if (!from)
+			break;
+		type--;
+
+		depth++;
+		gains[depth] = values[on_tile] - gains[depth - 1];
+		on_tile = type;
+		// Taking the attacker off the board can uncover a slider behind it
+		occupied &= ~BIT(LSB(from));
+		attackers = all_attackers_to(g, end, occupied) & occupied;
+		side = !side;
 	}
 
-	return 0;
+	// Either side can stop capturing when it would lose by going on
+	while (depth > 0) {
+		if (gains[depth] > -gains[depth - 1])
+			gains[depth - 1] = -gains[depth];
+		depth--;
+	}
+	return gains[0];
 }
 
-static move* new_move(int start, int end, int captured, int promotion, int en_passant, int castle, move* next) {
-	move* nm = malloc(sizeof(move));
-	nm->start = start;
-	nm->end = end;
-	nm->captured = captured;
-	nm->promotion = promotion;
-	nm->en_passant = en_passant;
-	nm->castle = castle;
-	nm->next = next;
-	return nm;
+// Returns whether a tile is under attack by the opponent of color index c
+//   Technically not general, as doesn't include en passant attacks; meant for king
+static int tile_attacked(game* g, int tile, int c) {
+	STATS_START();
+	bitboard* enemy = g->bitboards[!c];
+	bitboard occupied = g->occupancy[0] | g->occupancy[1];
+
+	// A piece on the tile would attack the same tiles that can attack it
+	int attacked = (knight_attacks[tile] & enemy[knight]) ||
+		(king_attacks[tile] & enemy[king]) ||
+		(pawn_attacks[c][tile] & enemy[pawn]) ||
+		(BISHOP_ATTACKS(tile, occupied) & (enemy[bishop] | enemy[queen])) ||
+		(ROOK_ATTACKS(tile, occupied) & (enemy[rook] | enemy[queen]));
+	STATS_END(stat_tile_attacked);
+	return attacked;
 }
 
-// Revokes the previous move
-static void undo_move(game* g) {
+// Returns whether the side to move is in check
+int in_check(game* g) {
+	int c = COL_I(g->turn);
+	return tile_attacked(g, g->king_tiles[c], c);
+}
 
-	// Save most recent move
-	move* prevm = g->moves_tail;
+// Appends a move to a move list
+static void new_move(move_list* l, int start, int end, int flag) {
+	STATS_COUNT(stat_new_move);
+	l->moves[l->count++] = MOVE(start, end, flag);
+}
 
-	// Fix move history
-	move* ntail = g->moves_head;
-	while (ntail) {
-		if (ntail->next == prevm) {
-			g->moves_tail = ntail;
-			break;
-		}
-		ntail = ntail->next;
-	}
+// Revokes the previous move
+void undo_move(game* g) {
+	STATS_START();
+	undo_record* u = &g->history[--g->ply];
+	int start = MOVE_START(u->m);
+	int end = MOVE_END(u->m);
+	int piece = g->board[end];
+	g->turn = PIECE_COLOR(piece);
 
-	int piece = g->board[prevm->end];
-	
 	// Track kings
 	if (PIECE_TYPE(piece) == king)
-		g->king_tiles[COL_I(PIECE_COLOR(piece))] = prevm->start;
+		g->king_tiles[COL_I(piece)] = start;
 
 	// Create old piece (and depromote)
-	if (prevm->promotion)
-		g->board[prevm->start] = (PIECE_COLOR(piece) | pawn);
-	else
-		g->board[prevm->start] = piece;
-	// Uncapture
-	g->board[prevm->end] = prevm->captured;
-	// En passant case (moves_tail->end is now the would-be location of the victim pawn)
-	if (prevm->en_passant)
-		g->board[g->moves_tail->end] = (PIECE_OCOLOR(piece) | pawn);
-	
+	if (MOVE_PROMOTION(u->m))
+		change_tile(g, end, PIECE_COLOR(piece) | pawn);
+	move_tile(g, end, start);
+	// Uncapture (including en passant)
+	if (u->captured)
+		set_tile(g, u->captured_tile, u->captured);
+
 	// Move the rook when castling
-	switch (prevm->castle) {
-		// Right
-		case 2:
-			g->board[prevm->start + 3] = PIECE_COLOR(piece) | rook;
-			g->board[prevm->end - 1] = 0;
+	switch (MOVE_FLAG(u->m)) {
+		case flag_castle_right:
+			move_tile(g, end - 1, start + 3);
 			break;
-		// Left
-		case 1:
-			g->board[prevm->start - 4] = PIECE_COLOR(piece) | rook;
-			g->board[prevm->end + 1] = 0;
+		case flag_castle_left:
+			move_tile(g, end + 1, start - 4);
 			break;
 	}
 
+	// Swap back the keys of the other position state
+	g->hash ^= zobrist_castle[g->castle_rights] ^ zobrist_castle[u->castle_rights];
+	if (g->en_passant != -1)
+		g->hash ^= zobrist_en_passant[g->en_passant % 8];
+	if (u->en_passant != -1)
+		g->hash ^= zobrist_en_passant[u->en_passant % 8];
+	g->hash ^= zobrist_turn;
+
+	g->castle_rights = u->castle_rights;
+	g->en_passant = u->en_passant;
+	g->halfmove_clock = u->halfmove_clock;
+	if (g->turn == black)
+		g->fullmove--;
+	STATS_END(stat_undo_move);
 }
 
-// Returns a list of legal moves given a list of pseudo legal moves
-static move* filter_legal_moves(game* g, move* m) {
-	move* legal_head = NULL;
-	move* legal_tail = NULL;
+// Finds the checkers and pinned pieces of color index c
+static void compute_legality(game* g, int c, legality* info) {
+	int king_tile = g->king_tiles[c];
+	bitboard* enemy = g->bitboards[!c];
+	bitboard occupied = g->occupancy[0] | g->occupancy[1];
+
+	info->checkers = attackers_to(g, king_tile, c, occupied);
+	info->evasions = ~0ULL;
+	if (info->checkers)
+		info->evasions = info->checkers | between[king_tile][LSB(info->checkers)];
+
+	// Sliders that would attack the king through exactly one of its own pieces
+	info->pinned = 0;
+	bitboard snipers = (ROOK_ATTACKS(king_tile, g->occupancy[!c]) & (enemy[rook] | enemy[queen])) |
+		(BISHOP_ATTACKS(king_tile, g->occupancy[!c]) & (enemy[bishop] | enemy[queen]));
+	for (; snipers; snipers &= snipers - 1) {
+		bitboard blockers = between[king_tile][LSB(snipers)] & occupied;
+		if (POPCOUNT(blockers) == 1 && (blockers & g->occupancy[c]))
+			info->pinned |= blockers;
+	}
+}
 
-	while (m) {
+// Returns whether an en passant capture by the pawn on a tile keeps its king safe;
+//   it removes two pieces from a rank at once, so pins alone can't tell
+static int en_passant_legal(game* g, int tile) {
+	int c = COL_I(g->board[tile]);
+	int captured = g->en_passant - pawn_locations[c][2];
+	bitboard occupied = ((g->occupancy[0] | g->occupancy[1]) ^ BIT(tile) ^ BIT(captured)) | BIT(g->en_passant);
+	return !(attackers_to(g, g->king_tiles[c], c, occupied) & ~BIT(captured));
+}
+
+// Removes moves that leave the king in check from a list, starting at index start
+static void filter_legal_moves(game* g, move_list* l, int start) {
+	STATS_START();
+	int legal = start;
+	int c = COL_I(g->turn);
+
+	for (int i = start; i < l->count; i++) {
+		move m = l->moves[i];
 		// Play each move
 		make_move(g, m);
-		// If king is not attacked, copy and add to legal moves
-		if (!tile_attacked(g, g->king_tiles[COL_I(g->turn)])) {
-			move* lm = new_move(m->start, m->end, m->captured, m->promotion, m->en_passant, m->castle, NULL);
-			APPEND_LIST(legal_tail, legal_head, lm);
-		}
+		// If king is not attacked, keep it in the legal part of the list
+		if (!tile_attacked(g, g->king_tiles[c], c))
+			l->moves[legal++] = m;
 
 		undo_move(g);
-		m = m->next;
-	}
-	// Free pseudo-legal list
-	while (m) {
-		move* om = m;
-		m = m->next;
-		free(om);
 	}
 
-	return legal_head;
+	l->count = legal;
+	STATS_END(stat_filter_legal_moves);
 }
 
 // Computes information about valid moves
@@ -233,7 +368,15 @@ void compute_move_data() {
 		tiles_from_edge[tile][6] = min(north, east);
 		tiles_from_edge[tile][7] = min(south, west);
 
+		// Calculate sliding rays
+		for (int di = 0; di < 8; di++) {
+			rays[tile][di] = 0;
+			for (int i = 0; i < tiles_from_edge[tile][di]; i++)
+				rays[tile][di] |= BIT(tile + directions[di] * (i + 1));
+		}
+
 		// Calculate knight moves
+		knight_attacks[tile] = 0;
 		for (int i = 0; i < 8; i++) {
 			int jump_tile = tile + knight_jump_offsets[i];
 			if (jump_tile >= 0 && jump_tile < 64) {
@@ -241,258 +384,322 @@ void compute_move_data() {
 				int jump_file = jump_tile % 8;
 				int move_distance = max(abs(file - jump_file), abs(rank - jump_rank));
 				if (move_distance == 2)
-					knight_jumps[tile][i] = jump_tile;
-				else
-					knight_jumps[tile][i] = -1;
+					knight_attacks[tile] |= BIT(jump_tile);
 			}
 		}
 
 		// Calculate king moves
-		for (int i = 0; i < 8; i++) {
-			int move_tile = tile + directions[i];
-			if (move_tile >= 0 && move_tile < 64) {
-				int move_rank = move_tile / 8;
-				int move_file = move_tile % 8;
-				int move_distance = max(abs(file - move_file), abs(rank - move_rank));
-				if (move_distance == 1)
-					king_moves[tile][i] = move_tile;
-				else
-					king_moves[tile][i] = -1;
+		king_attacks[tile] = 0;
+		for (int di = 0; di < 8; di++) {
+			if (tiles_from_edge[tile][di] > 0)
+				king_attacks[tile] |= BIT(tile + directions[di]);
+		}
+
+		// Calculate castling rights kept by touching the tile
+		castle_masks[tile] = ALL_CASTLE_RIGHTS;
+
+		// Calculate pawn captures
+		for (int c = 0; c < 2; c++) {
+			pawn_attacks[c][tile] = 0;
+			for (int i = 0; i < 2; i++) {
+				int di = pawn_capture_directions[c][i];
+				if (tiles_from_edge[tile][di] > 0)
+					pawn_attacks[c][tile] |= BIT(tile + directions[di]);
 			}
 		}
-		
-		// Calculate king distances
-		for (int t2 = 0; t2 < 64; t2++) {
-			int r2 = t2 / 8;
-			int f2 = t2 % 8;
-			king_distances[tile][t2] = max(abs(rank - r2), abs(file - f2));
+	}
+
+	// Calculate the tiles between and through any two tiles on a line
+	//   (directions come in opposite pairs, so di ^ 1 reverses di)
+	for (int tile = 0; tile < 64; tile++) {
+		for (int di = 0; di < 8; di++) {
+			for (bitboard ray = rays[tile][di]; ray; ray &= ray - 1) {
+				int other = LSB(ray);
+				between[tile][other] = rays[tile][di] & ~rays[other][di] & ~BIT(other);
+				lines[tile][other] = rays[tile][di] | rays[tile][di ^ 1] | BIT(tile);
+			}
 		}
 	}
+
+	compute_zobrist_keys();
+	compute_eval_tables();
+
+	// Moving a king or rook, or capturing a rook, from its starting tile
+	for (int c = 0; c < 2; c++) {
+		castle_masks[c * 56 + 4] &= ~(CASTLE_RIGHT(c, 0) | CASTLE_RIGHT(c, 1));
+		castle_masks[c * 56] &= ~CASTLE_RIGHT(c, 0);
+		castle_masks[c * 56 + 7] &= ~CASTLE_RIGHT(c, 1);
+	}
 }
 
-// Makes a move
-void make_move(game* g, move* m) {
+// Makes a move, pushing what is needed to revoke it onto the undo stack
+void make_move(game* g, move m) {
+	STATS_START();
+	undo_record* u = &g->history[g->ply++];
+	int start = MOVE_START(m);
+	int end = MOVE_END(m);
+	int flag = MOVE_FLAG(m);
+	int piece = g->board[start];
+	int c = COL_I(piece);
+
+	u->m = m;
+	u->captured_tile = (flag == flag_en_passant) ? end - pawn_locations[c][2] : end;
+	u->captured = g->board[u->captured_tile];
+	u->castle_rights = g->castle_rights;
+	u->en_passant = g->en_passant;
+	u->halfmove_clock = g->halfmove_clock;
+	u->hash = g->hash;
 
 	// Delete any captured piece from board
-	int piece = g->board[m->start];
-	int occupying = g->board[m->end];
-	if (ENEMY_COLOR(piece, occupying)) {
-		del_piece(g->pieces[!COL_I(piece)], m->end);
-	}
+	if (u->captured)
+		clear_tile(g, u->captured_tile);
 
 	// Track king locations
 	if (PIECE_TYPE(piece) == king)
-		g->king_tiles[COL_I(g->turn)] = m->end;
+		g->king_tiles[c] = end;
 
-	if (m->promotion) {
+	if (MOVE_PROMOTION(m)) {
 		// Create promoted piece
-		g->board[m->end] = PIECE_TYPE(promotion_prompt()) | PIECE_COLOR(piece);
-		g->board[m->start] = 0;
+		move_tile(g, start, end);
+		change_tile(g, end, MOVE_PROMOTION(m) | PIECE_COLOR(piece));
 	} else {
-		// Manage piece list/capturing for en passant
-		if (m->en_passant) {
-			g->board[g->moves_tail->end] = 0;
-			del_piece(g->pieces[!COL_I(piece)], g->moves_tail->end);
-		}
-
 		// Move the rook when castling
-		switch (m->castle) {
-			// Right
-			case 2:
-				g->board[m->start + 3] = 0;
-				g->board[m->end - 1] = PIECE_COLOR(piece) | rook;
+		switch (flag) {
+			case flag_castle_right:
+				move_tile(g, start + 3, end - 1);
 				break;
-			// Left
-			case 1:
-				g->board[m->start - 4] = 0;
-				g->board[m->end + 1] = PIECE_COLOR(piece) | rook;
+			case flag_castle_left:
+				move_tile(g, start - 4, end + 1);
 				break;
 		}
 
 		// Move the piece
-		g->board[m->end] = piece;
-		g->board[m->start] = 0;
+		move_tile(g, start, end);
 	}
 
-	// Add to move history
-	if (g->moves_tail) {
-		g->moves_tail->next = m;
-		g->moves_tail = m;
+	// Captures and pawn moves can't be repeated
+	if (u->captured || (PIECE_TYPE(piece) == pawn))
+		g->halfmove_clock = 0;
+	else
+		g->halfmove_clock++;
+	if (PIECE_COLOR(piece) == black)
+		g->fullmove++;
+
+	// A two tile pawn push allows en passant on the skipped tile, if an enemy pawn is there to use it
+	if (g->en_passant != -1)
+		g->hash ^= zobrist_en_passant[g->en_passant % 8];
+	g->en_passant = -1;
+	if (flag == flag_double_push) {
+		int skipped = (start + end) / 2;
+		if (pawn_attacks[c][skipped] & g->bitboards[!c][pawn]) {
+			g->en_passant = skipped;
+			g->hash ^= zobrist_en_passant[skipped % 8];
+		}
+	}
+
+	g->hash ^= zobrist_castle[g->castle_rights];
+	g->castle_rights &= castle_masks[start] & castle_masks[end];
+	g->hash ^= zobrist_castle[g->castle_rights];
+
+	g->turn = PIECE_OCOLOR(piece);
+	g->hash ^= zobrist_turn;
+	STATS_END(stat_make_move);
+}
+
+// Adds a pawn move, as one move per piece it can promote to when reaching the last rank
+static void new_pawn_move(move_list* l, int start, int end, int flag, int promotes) {
+	if (promotes) {
+		for (int type = queen; type >= knight; type--)
+			new_move(l, start, end, flag | flag_promotion | (type - knight));
 	} else {
-		g->moves_head = m;
-		g->moves_tail = m;
+		new_move(l, start, end, flag);
 	}
 }
 
-// Gets moves for a pawn
-static move* get_pawn_moves(game* g, int tile) {
-	move* m = NULL;
-	move* head = NULL;
+// Gets moves for a pawn to allowed tiles, with en passant checked for legality if legal is set
+static void get_pawn_moves(game* g, int tile, move_list* l, bitboard allowed, int legal) {
 	int* board = g->board;
 	int piece = board[tile];
 	int c = COL_I(piece);
 	int forward = pawn_locations[c][2];
 	int rank = tile / 8;
 	int next_promotion = rank == pawn_locations[c][1];
+	bitboard occupied = g->occupancy[0] | g->occupancy[1];
 
 	// Forward
 	int forward_tile = tile + forward;
-	if (board[forward_tile] == 0) {
-		move* nm = new_move(tile, forward_tile, 0, next_promotion ? 1 : 0, 0, 0, NULL);
-		APPEND_LIST(m, head, nm);
+	if (!(occupied & BIT(forward_tile))) {
+		if (allowed & BIT(forward_tile))
+			new_pawn_move(l, tile, forward_tile, flag_quiet, next_promotion);
 		if (rank == pawn_locations[c][0]) {
 			int two_forward = forward_tile + forward;
-			if (board[two_forward] == 0) {
-				move* nm = new_move(tile, two_forward, 0, 0, 0, 0, NULL);
-				APPEND_LIST(m, head, nm);
-			}
+			if (!(occupied & BIT(two_forward)) && (allowed & BIT(two_forward)))
+				new_move(l, tile, two_forward, flag_double_push);
 		}
 	}
 
 	// Captures
-	for (int i = 0; i < 2; i++) {
-		if (tiles_from_edge[tile][pawn_capture_directions[c][i]] > 0) {
-			int capture_direction = directions[pawn_capture_directions[c][i]];
-			int destination = tile + capture_direction;
-			int occupying = board[destination];
-			if (ENEMY_COLOR(occupying, piece)) {
-				move* nm = new_move(tile, destination, g->board[destination], next_promotion ? 1 : 0, 0, 0, NULL);
-				APPEND_LIST(m, head, nm);
-
-			// En passant
-			} else if ((tile / 8) == pawn_locations[!c][3]) {
-				move* last_move = g->moves_tail;
-				if (two_pawn_push(last_move, board) && (last_move->end == destination + pawn_locations[!c][2])) {
-					move* nm = new_move(tile, destination, 0, 0, 1, 0, NULL);
-					APPEND_LIST(m, head, nm);
-				}
-			}
-		}
+	for (bitboard targets = pawn_attacks[c][tile] & g->occupancy[!c] & allowed; targets; targets &= targets - 1) {
+		int destination = LSB(targets);
+		new_pawn_move(l, tile, destination, flag_capture, next_promotion);
 	}
 
-	return head;
+	// En passant
+	if ((g->en_passant != -1) && (pawn_attacks[c][tile] & BIT(g->en_passant)) &&
+		(!legal || en_passant_legal(g, tile)))
+		new_move(l, tile, g->en_passant, flag_en_passant);
 }
 
-// Gets moves for a sliding piece
-static move* get_sliding_moves(int board[64], int tile) {
-	move* m = NULL;
-	move* head = NULL;
-	int piece = board[tile];
+// Gets moves for a sliding piece to allowed tiles
+static void get_sliding_moves(game* g, int tile, move_list* l, bitboard allowed) {
+	int piece = g->board[tile];
 	int di_start = (PIECE_TYPE(piece) == bishop) ? 4 : 0;
 	int di_end = (PIECE_TYPE(piece) == rook) ? 4 : 8;
+	bitboard occupied = g->occupancy[0] | g->occupancy[1];
+	bitboard targets = sliding_attacks(tile, occupied, di_start, di_end) & ~g->occupancy[COL_I(piece)] & allowed;
 
-	for (int di = di_start; di < di_end; di++) {
-		for (int i = 0; i < tiles_from_edge[tile][di]; i++) {
-			int destination = tile + directions[di] * (i + 1);
-			int occupying = board[destination];
-
-			if (SAME_COLOR(occupying, piece))
-				break;
-
-			move* nm = new_move(tile, destination, board[destination], 0, 0, 0, NULL);
-			APPEND_LIST(m, head, nm);
-
-			if (ENEMY_COLOR(occupying, piece))
-				break;
-		}
+	for (; targets; targets &= targets - 1) {
+		int destination = LSB(targets);
+		new_move(l, tile, destination, g->board[destination] ? flag_capture : flag_quiet);
 	}
-
-	return head;
 }
 
-// Gets moves for a knight
-static move* get_knight_moves(int board[64], int tile) {
-	move* m = NULL;
-	move* head = NULL;
-	int piece = board[tile];
-
-	for (int i = 0; i < 8; i++) {
-		if (knight_jumps[tile][i] == -1)
-			continue;
-		if SAME_COLOR(board[knight_jumps[tile][i]], piece)
-			continue;
+// Gets moves for a knight to allowed tiles
+static void get_knight_moves(game* g, int tile, move_list* l, bitboard allowed) {
+	int piece = g->board[tile];
+	bitboard targets = knight_attacks[tile] & ~g->occupancy[COL_I(piece)] & allowed;
 
-		move* nm = new_move(tile, knight_jumps[tile][i], board[knight_jumps[tile][i]], 0, 0, 0, NULL);
-		APPEND_LIST(m, head, nm);
+	for (; targets; targets &= targets - 1) {
+		int destination = LSB(targets);
+		new_move(l, tile, destination, g->board[destination] ? flag_capture : flag_quiet);
 	}
-
-	return head;
 }
 
-// Gets moves for a king
-static move* get_king_moves(game* g, int tile) {
-	move* m = NULL;
-	move* head = NULL;
+// Gets moves for a king to allowed tiles, leaving out moves onto attacked tiles if legal is set
+static void get_king_moves(game* g, int tile, move_list* l, bitboard allowed, int legal) {
 	int piece = g->board[tile];
+	int c = COL_I(piece);
+	bitboard targets = king_attacks[tile] & ~g->occupancy[c] & allowed;
+	// The king can't hide from a slider behind its own tile
+	bitboard occupied_without_king = (g->occupancy[0] | g->occupancy[1]) & ~BIT(tile);
 
-	for (int i = 0; i < 8; i++) {
-		if (king_moves[tile][i] == -1)
-			continue;
-		if (SAME_COLOR(g->board[king_moves[tile][i]], piece))
+	for (; targets; targets &= targets - 1) {
+		int destination = LSB(targets);
+		if (legal && attackers_to(g, destination, c, occupied_without_king))
 			continue;
-
-		move* nm = new_move(tile, king_moves[tile][i], g->board[king_moves[tile][i]], 0, 0, 0, NULL);
-		APPEND_LIST(m, head, nm);
+		new_move(l, tile, destination, g->board[destination] ? flag_capture : flag_quiet);
 	}
 
-	// Castling:
-	if ((!g->king_moved[COL_I(piece)]) && (!tile_attacked(g, tile))) {
+	// Castling (rights are only held while the king and rook are on their starting tiles):
+	if ((g->castle_rights & (CASTLE_RIGHT(c, 0) | CASTLE_RIGHT(c, 1))) && (!tile_attacked(g, tile, c))) {
+		bitboard occupied = g->occupancy[0] | g->occupancy[1];
 		// Direction index, di = 3 is right, = 2 is left
 		for (int di = 2; di < 4; di++) {
-			// Rook moved index, 1 is right, 0 is left
-			if (!g->rook_moved[COL_I(piece)][di - 2]) {
-				for (int i = 0; i < 2; i++) {
-					int destination = tile + directions[di] * (i + 1);
-
-					if (g->board[destination] != 0)
-						break;
-
-					if (tile_attacked(g, destination))
-						break;
-
-					// Castle move property, 2 is right, 1 is left
-					if (i == 1) {
-						// Nothing between rook and king on left side
-						if ((di == 2) && (g->board[destination - 1] != 0))
-							break;
-
-						move* nm = new_move(tile, destination, 0, 0, 0, di - 1, NULL);
-						APPEND_LIST(m, head, nm);
-					}
-				}
-			}
+			// Castling side, 1 is right, 0 is left
+			if (!(g->castle_rights & CASTLE_RIGHT(c, di - 2)))
+				continue;
+
+			// Tiles between king and rook must be empty (three on the left side)
+			int step = directions[di];
+			bitboard between = BIT(tile + step) | BIT(tile + step * 2);
+			if (di == 2)
+				between |= BIT(tile + step * 3);
+			if ((occupied & between) || !(allowed & BIT(tile + step * 2)))
+				continue;
+
+			// King may not pass through or land on an attacked tile
+			if (tile_attacked(g, tile + step, c) || tile_attacked(g, tile + step * 2, c))
+				continue;
+
+			new_move(l, tile, tile + step * 2, (di == 3) ? flag_castle_right : flag_castle_left);
 		}
 	}
+}
 
-	return head;
+// Appends the legal moves of a specific piece to target tiles to a list,
+//   only generating moves that stay out of check
+static void add_legal_moves(game* g, int tile, move_list* l, legality* info, bitboard targets) {
+	STATS_START();
+	int piece = g->board[tile];
+	if (PIECE_TYPE(piece) == king) {
+		get_king_moves(g, tile, l, targets, 1);
+	} else if (!(info->checkers & (info->checkers - 1))) {
+		// Only the king can escape a double check, and pinned pieces stay on
+		//   the line between their king and the pinner
+		bitboard allowed = info->evasions & targets;
+		if (info->pinned & BIT(tile))
+			allowed &= lines[g->king_tiles[COL_I(piece)]][tile];
+
+		switch (PIECE_TYPE(piece)) {
+			case pawn:
+				get_pawn_moves(g, tile, l, allowed, 1);
+				break;
+			case knight:
+				get_knight_moves(g, tile, l, allowed);
+				break;
+			default:
+				get_sliding_moves(g, tile, l, allowed);
+				break;
+		}
+	}
+	STATS_END(stat_pawn_moves + PIECE_TYPE(piece));
 }
 
-// Gets moves for a specific piece
-move* get_piece_moves(game* g, int tile) {
+// Appends the legal moves of a specific piece to a list by playing each
+//   pseudo-legal move, the slower reference for add_legal_moves
+static void add_filtered_moves(game* g, int tile, move_list* l) {
+	int start = l->count;
 	switch (PIECE_TYPE(g->board[tile])) {
 		case pawn:
-			return filter_legal_moves(g, get_pawn_moves(g, tile));
+			get_pawn_moves(g, tile, l, ~0ULL, 0);
+			break;
 		case knight:
-			return filter_legal_moves(g, get_knight_moves(g->board, tile));
+			get_knight_moves(g, tile, l, ~0ULL);
+			break;
 		case king:
-			return filter_legal_moves(g, get_king_moves(g, tile));
+			get_king_moves(g, tile, l, ~0ULL, 0);
+			break;
 		default:
-			return filter_legal_moves(g, get_sliding_moves(g->board, tile));
+			get_sliding_moves(g, tile, l, ~0ULL);
+			break;
 	}
+	filter_legal_moves(g, l, start);
+}
+
+// Gets moves for a specific piece
+void get_piece_moves(game* g, int tile, move_list* l) {
+	legality info;
+	compute_legality(g, COL_I(g->board[tile]), &info);
+	l->count = 0;
+	add_legal_moves(g, tile, l, &info, ~0ULL);
 }
 
 // Gets moves for a color index
-move* get_moves(game* g, int c) {
-	move* m = NULL;
-	move* head = NULL;
-	piece_list* p = g->pieces[c];
-	while (p) {
-		move* nm = get_piece_moves(g, p->tile);
-		APPEND_LIST(m, head, nm);
-		if (m)
-			while (m->next) 
-				m = m->next;
-		p = p->next;
+void get_moves(game* g, int c, move_list* l) {
+	legality info;
+	compute_legality(g, c, &info);
+	l->count = 0;
+	for (int i = 0; i < g->piece_count[c]; i++)
+		add_legal_moves(g, g->pieces[c][i], l, &info, ~0ULL);
+}
+
+// Gets the captures and promotions (including en passant) for a color index
+void get_captures(game* g, int c, move_list* l) {
+	legality info;
+	compute_legality(g, c, &info);
+	l->count = 0;
+	// Pawns may also move onto the last rank
+	bitboard pawn_targets = g->occupancy[!c] | (c ? 0xffULL : 0xffULL << 56);
+	for (int i = 0; i < g->piece_count[c]; i++) {
+		int tile = g->pieces[c][i];
+		add_legal_moves(g, tile, l, &info, (PIECE_TYPE(g->board[tile]) == pawn) ? pawn_targets : g->occupancy[!c]);
 	}
-	return head;
+}
+
+// Gets moves for a color index the way get_moves did before it tracked pins
+//   and checks, for checking it and comparing speed
+void get_moves_filtered(game* g, int c, move_list* l) {
+	l->count = 0;
+	for (int i = 0; i < g->piece_count[c]; i++)
+		add_filtered_moves(g, g->pieces[c][i], l);
 }
@@ -0,0 +1,288 @@
+// Chess implemented in C; perft.c implements move generation testing
+//   by counting the leaf nodes of the move tree, on one thread or several.
+// Copyright (C) 2021 Theo Henson.
+// Released under the GPL v3.0, see LICENSE.
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "game.h"
+
+// Published perft results, see https://www.chessprogramming.org/Perft_Results
+static const struct {
+	char* name;
+	char* fen;
+	int depth;
+	unsigned long long nodes[6];
+} perft_positions[] = {
+	{ "startpos", "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+		5, { 20, 400, 8902, 197281, 4865609 } },
+	{ "kiwipete", "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+		4, { 48, 2039, 97862, 4085603 } },
+	{ "position 3", "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+		5, { 14, 191, 2812, 43238, 674624 } },
+	{ "position 4", "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+		4, { 6, 264, 9467, 422333 } },
+	{ "position 5", "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+		4, { 44, 1486, 62379, 2103487 } },
+};
+
+// Orders moves by value, to compare lists as sets
+static int compare_moves(const void* a, const void* b) {
+	return *(const move*)a - *(const move*)b;
+}
+
+// Walks the move tree to a given depth checking that get_moves and
+//   get_moves_filtered find the same moves, returns the positions where they differ
+unsigned long long perft_verify(game* g, int depth, unsigned long long* positions) {
+	move_list l, filtered;
+	get_moves(g, COL_I(g->turn), &l);
+	get_moves_filtered(g, COL_I(g->turn), &filtered);
+	(*positions)++;
+
+	unsigned long long mismatches = 0;
+	qsort(l.moves, l.count, sizeof(move), compare_moves);
+	qsort(filtered.moves, filtered.count, sizeof(move), compare_moves);
+	if (l.count != filtered.count) {
+		mismatches++;
+	} else {
+		for (int i = 0; i < l.count; i++) {
+			if (l.moves[i] != filtered.moves[i]) {
+				mismatches++;
+				break;
+			}
+		}
+	}
+
+	if (depth > 1) {
+		for (int i = 0; i < l.count; i++) {
+			make_move(g, l.moves[i]);
+			mismatches += perft_verify(g, depth - 1, positions);
+			undo_move(g);
+		}
+	}
+	return mismatches;
+}
+
+// A parallel perft thread: its own copy of the game, and a deque of root
+//   moves it works through from the front while idle threads steal from the back
+struct {
+	int id;
+	game* g;
+	pthread_mutex_t lock;
+	int tasks[MAX_MOVES];
+	int head;
+	int tail;
+	unsigned long long nodes;
+	int done;
+	int stolen;
+	tt_stats tt_counters;
+} typedef perft_worker;
+
+// Shared state of a parallel perft
+static perft_worker* workers;
+static int worker_count;
+static move_list root;
+static unsigned long long root_nodes[MAX_MOVES];
+static int root_depth;
+
+// Counts the leaf nodes of the legal move tree to a given depth
+unsigned long long perft(game* g, int depth) {
+	if (depth == 0)
+		return 1;
+
+	// Reuse the count of a transposed subtree
+	unsigned long long nodes = 0;
+	if (depth > 1 && tt_probe_perft(g->hash, depth, &nodes))
+		return nodes;
+
+	move_list l;
+	get_moves(g, COL_I(g->turn), &l);
+	// Bulk count the last ply
+	if (depth == 1)
+		return l.count;
+
+	for (int i = 0; i < l.count; i++) {
+		make_move(g, l.moves[i]);
+		nodes += perft(g, depth - 1);
+		undo_move(g);
+	}
+	tt_store_perft(g->hash, depth, nodes);
+	return nodes;
+}
+
+// Runs perft, optionally printing the node count below each root move, and reports speed
+unsigned long long perft_divide(game* g, int depth, int divide) {
+	unsigned long long start = time_ns();
+	unsigned long long nodes = 0;
+	memset(&tt_counters, 0, sizeof(tt_counters));
+
+	if (divide && depth > 0) {
+		move_list l;
+		get_moves(g, COL_I(g->turn), &l);
+		char notation[6];
+		for (int i = 0; i < l.count; i++) {
+			make_move(g, l.moves[i]);
+			unsigned long long n = perft(g, depth - 1);
+			undo_move(g);
+			move_notation(l.moves[i], notation);
+			printf("%s: %llu\n", notation, n);
+			nodes += n;
+		}
+		printf("\n");
+	} else {
+		nodes = perft(g, depth);
+	}
+
+	unsigned long long elapsed = time_ns() - start;
+	printf("nodes: %llu\n", nodes);
+	printf("time: %.3fs\n", elapsed / 1e9);
+	printf("nps: %.0f\n", elapsed ? nodes * 1e9 / elapsed : 0.0);
+	if (tt_size())
+		tt_print_stats();
+	return nodes;
+}
+
+// Takes the next root move for a worker, stealing one if its deque is empty;
+//   returns -1 when there are none left
+static int next_task(perft_worker* w) {
+	int task = -1;
+	pthread_mutex_lock(&w->lock);
+	if (w->head < w->tail)
+		task = w->tasks[w->head++];
+	pthread_mutex_unlock(&w->lock);
+
+	for (int i = 1; i < worker_count && task < 0; i++) {
+		perft_worker* victim = &workers[(w->id + i) % worker_count];
+		pthread_mutex_lock(&victim->lock);
+		if (victim->head < victim->tail)
+			task = victim->tasks[--victim->tail];
+		pthread_mutex_unlock(&victim->lock);
+		if (task >= 0)
+			w->stolen++;
+	}
+	return task;
+}
+
+static void* perft_thread(void* arg) {
+	perft_worker* w = arg;
+	int task;
+	while ((task = next_task(w)) >= 0) {
+		make_move(w->g, root.moves[task]);
+		unsigned long long n = perft(w->g, root_depth - 1);
+		undo_move(w->g);
+		root_nodes[task] = n;
+		w->nodes += n;
+		w->done++;
+	}
+	w->tt_counters = tt_counters;
+	stats_flush();
+	return NULL;
+}
+
+// Runs perft with the root moves spread over a number of threads, optionally
+//   printing the node count below each root move, and reports each thread's share
+unsigned long long perft_parallel(game* g, int depth, int threads, int divide) {
+	if (depth < 2 || threads < 2)
+		return perft_divide(g, depth, divide);
+	if (threads > MAX_THREADS)
+		threads = MAX_THREADS;
+
+	unsigned long long start = time_ns();
+	memset(&tt_counters, 0, sizeof(tt_counters));
+	get_moves(g, COL_I(g->turn), &root);
+	root_depth = depth;
+	worker_count = threads;
+	workers = malloc(threads * sizeof(perft_worker));
+	game* games = malloc(threads * sizeof(game));
+	pthread_t handles[MAX_THREADS];
+	if (!workers || !games) {
+		fprintf(stderr, "chess: could not allocate perft threads\n");
+		exit(1);
+	}
+
+	// Deal the root moves out in turn
+	for (int i = 0; i < threads; i++) {
+		games[i] = *g;
+		workers[i] = (perft_worker){ .id = i, .g = &games[i], .head = 0, .tail = 0 };
+		pthread_mutex_init(&workers[i].lock, NULL);
+	}
+	for (int i = 0; i < root.count; i++) {
+		perft_worker* w = &workers[i % threads];
+		w->tasks[w->tail++] = i;
+	}
+
+	for (int i = 0; i < threads; i++)
+		pthread_create(&handles[i], NULL, perft_thread, &workers[i]);
+	for (int i = 0; i < threads; i++) {
+		pthread_join(handles[i], NULL);
+		tt_add_stats(&workers[i].tt_counters);
+	}
+	unsigned long long elapsed = time_ns() - start;
+
+	unsigned long long nodes = 0;
+	char notation[6];
+	for (int i = 0; i < root.count; i++) {
+		nodes += root_nodes[i];
+		if (divide) {
+			move_notation(root.moves[i], notation);
+			printf("%s: %llu\n", notation, root_nodes[i]);
+		}
+	}
+	if (divide)
+		printf("\n");
+
+	for (int i = 0; i < threads; i++) {
+		printf("thread %d: %llu nodes (%.1f%%), %d root moves (%d stolen)\n", i, workers[i].nodes,
+			nodes ? workers[i].nodes * 100.0 / nodes : 0.0, workers[i].done, workers[i].stolen);
+		pthread_mutex_destroy(&workers[i].lock);
+	}
+	printf("nodes: %llu\n", nodes);
+	printf("time: %.3fs\n", elapsed / 1e9);
+	printf("nps: %.0f\n", elapsed ? nodes * 1e9 / elapsed : 0.0);
+	if (tt_size())
+		tt_print_stats();
+
+	free(games);
+	free(workers);
+	return nodes;
+}
+
+// Checks perft against the published positions up to max_depth (0 for all),
+//   and the opening book keys against the Polyglot test values; returns the
+//   number of failures
+int perft_suite(int max_depth) {
+	int failures = 0;
+	unsigned long long total_nodes = 0;
+	unsigned long long total_time = 0;
+
+	for (int p = 0; p < sizeof(perft_positions) / sizeof(perft_positions[0]); p++) {
+		game g;
+		load_fen(perft_positions[p].fen, &g);
+		for (int d = 1; d <= perft_positions[p].depth && (max_depth <= 0 || d <= max_depth); d++) {
+			unsigned long long start = time_ns();
+			unsigned long long nodes = perft(&g, d);
+			unsigned long long elapsed = time_ns() - start;
+			unsigned long long expected = perft_positions[p].nodes[d - 1];
+
+			total_nodes += nodes;
+			total_time += elapsed;
+			printf("%-12s depth %d: %12llu %s",
+				perft_positions[p].name, d, nodes, (nodes == expected) ? "ok" : "FAIL");
+			if (nodes != expected) {
+				printf(" (expected %llu)", expected);
+				failures++;
+			}
+			printf("\n");
+		}
+	}
+	failures += book_check_keys();
+
+	printf("\nnodes: %llu\n", total_nodes);
+	printf("time: %.3fs\n", total_time / 1e9);
+	printf("nps: %.0f\n", total_time ? total_nodes * 1e9 / total_time : 0.0);
+	printf("%d failed\n", failures);
+	return failures;
+}
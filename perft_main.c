@@ -0,0 +1,117 @@
+// Chess implemented in C; perft_main.c is the entry point of chess-perft,
+//   a standalone move generator test and benchmark.
+// Copyright (C) 2021 Theo Henson.
+// Released under the GPL v3.0, see LICENSE.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "game.h"
+
+static void usage() {
+	fprintf(stderr, "usage: chess-perft [-d] [-H mb] [-j threads [-c]] depth [fen]\n");
+	fprintf(stderr, "       chess-perft -v depth [fen]\n");
+	fprintf(stderr, "       chess-perft -s [max depth]\n");
+	fprintf(stderr, "       chess-perft -e file [max depth]\n");
+	fprintf(stderr, "       chess-perft -p file\n");
+	fprintf(stderr, "       chess-perft -b [text | csv | json]\n");
+	exit(2);
+}
+
+int main(int argc, char* argv[]) {
+	compute_move_data();
+	if (stats_enabled())
+		atexit(stats_print);
+
+	int divide = 0;
+	int threads = 1;
+	int compare = 0;
+	int verify = 0;
+	int i = 1;
+	if (i < argc && strcmp(argv[i], "-s") == 0) {
+		int max_depth = (i + 1 < argc) ? atoi(argv[i + 1]) : 0;
+		return perft_suite(max_depth) ? 1 : 0;
+	}
+	if (i < argc && strcmp(argv[i], "-e") == 0) {
+		if (i + 1 >= argc)
+			usage();
+		int max_depth = (i + 2 < argc) ? atoi(argv[i + 2]) : 0;
+		return epd_run(argv[i + 1], max_depth, NULL) ? 1 : 0;
+	}
+	if (i < argc && strcmp(argv[i], "-b") == 0) {
+		bench_format format = bench_text;
+		if (i + 1 < argc && strcmp(argv[i + 1], "csv") == 0)
+			format = bench_csv;
+		else if (i + 1 < argc && strcmp(argv[i + 1], "json") == 0)
+			format = bench_json;
+		else if (i + 1 < argc && strcmp(argv[i + 1], "text") != 0)
+			usage();
+		bench_run(format);
+		return 0;
+	}
+	if (i < argc && strcmp(argv[i], "-p") == 0) {
+		if (i + 1 >= argc)
+			usage();
+		return pgn_run(argv[i + 1]) ? 1 : 0;
+	}
+	for (; i < argc && argv[i][0] == '-'; i++) {
+		if (strcmp(argv[i], "-d") == 0) {
+			divide = 1;
+		} else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+			// Spread the root moves over threads
+			threads = atoi(argv[++i]);
+			if (threads < 1 || threads > MAX_THREADS)
+				usage();
+		} else if (strcmp(argv[i], "-v") == 0) {
+			// Check the legal move generator against make/undo filtering
+			verify = 1;
+		} else if (strcmp(argv[i], "-c") == 0) {
+			// Also time the single threaded path
+			compare = 1;
+		} else if (strcmp(argv[i], "-H") == 0 && i + 1 < argc) {
+			// Cache subtree counts in a hash table
+			if (tt_resize(atoi(argv[++i]))) {
+				fprintf(stderr, "chess-perft: could not allocate hash table\n");
+				return 1;
+			}
+		} else {
+			usage();
+		}
+	}
+	if (i >= argc)
+		usage();
+
+	int depth = atoi(argv[i++]);
+	if (depth < 0)
+		usage();
+
+	game g;
+	if (load_fen((i < argc) ? argv[i] : GAME_FEN, &g)) {
+		fprintf(stderr, "chess-perft: bad fen\n");
+		return 1;
+	}
+	if (verify) {
+		unsigned long long positions = 0;
+		unsigned long long mismatches = perft_verify(&g, depth, &positions);
+		printf("positions: %llu\n", positions);
+		printf("mismatches: %llu\n", mismatches);
+		return mismatches ? 1 : 0;
+	}
+
+	unsigned long long start = time_ns();
+	perft_parallel(&g, depth, threads, divide);
+	unsigned long long parallel_time = time_ns() - start;
+
+	if (compare && threads > 1) {
+		printf("\nsingle thread:\n");
+		if (tt_size())
+			tt_clear();
+		start = time_ns();
+		perft_divide(&g, depth, 0);
+		unsigned long long single_time = time_ns() - start;
+		printf("\nspeedup with %d threads: %.2fx\n", threads,
+			parallel_time ? (double)single_time / parallel_time : 0.0);
+	}
+	return 0;
+}
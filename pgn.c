@@ -0,0 +1,315 @@
+// Chess implemented in C; pgn.c implements reading and writing games in
+//   Portable Game Notation. Files are read a token at a time and replayed on
+//   a single game, so databases of any size are read in the same memory.
+// Copyright (C) 2021 Theo Henson.
+// Released under the GPL v3.0, see LICENSE.
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "game.h"
+
+// Movetext lines are kept under 80 characters, as the standard asks
+#define PGN_LINE_LEN 79
+
+// Starts reading a PGN file
+void pgn_open(FILE* f, pgn_reader* r) {
+	memset(r, 0, sizeof(*r));
+	r->f = f;
+	r->line = 1;
+	r->line_start = 1;
+}
+
+static int next_char(pgn_reader* r) {
+	int c = getc_unlocked(r->f);
+	if (c == '\n')
+		r->line++;
+	r->line_start = (c == '\n');
+	return c;
+}
+
+// Skips to the end of a {comment}, or of a line for ; comments and % escapes
+static void skip_until(pgn_reader* r, int end) {
+	int c;
+	while ((c = next_char(r)) != EOF && c != end);
+}
+
+// Skips a (variation), which may hold comments and other variations
+static void skip_variation(pgn_reader* r) {
+	int depth = 1;
+	int c;
+	while (depth > 0 && (c = next_char(r)) != EOF) {
+		if (c == '{')
+			skip_until(r, '}');
+		else if (c == ';')
+			skip_until(r, '\n');
+		else if (c == '(')
+			depth++;
+		else if (c == ')')
+			depth--;
+	}
+}
+
+// Reads a [Name "value"] tag, keeping the value of a FEN tag
+static void read_tag(pgn_reader* r) {
+	char name[16];
+	char value[FEN_LEN];
+	int name_length = 0, value_length = 0;
+	int in_value = 0;
+	int c;
+	while ((c = next_char(r)) != EOF && (in_value || c != ']')) {
+		if (c == '"') {
+			in_value = !in_value;
+		} else if (in_value) {
+			if (c == '\\')
+				c = next_char(r);
+			if (c != EOF && value_length < FEN_LEN - 1)
+				value[value_length++] = c;
+		} else if (!isspace(c) && name_length < sizeof(name) - 1 && value_length == 0) {
+			name[name_length++] = c;
+		}
+	}
+	name[name_length] = '\0';
+	value[value_length] = '\0';
+	if (strcmp(name, "FEN") == 0)
+		strcpy(r->fen, value);
+}
+
+// Reads the next movetext token (a move, move number, result or NAG) into
+//   r->token, skipping tags, comments and variations; returns 1 at the end of
+//   the file, and 2 at a tag
+static int read_token(pgn_reader* r) {
+	int c;
+	int line_start = r->line_start;
+	while ((c = next_char(r)) != EOF) {
+		if (c == '%' && line_start)
+			skip_until(r, '\n');
+		else if (c == '{')
+			skip_until(r, '}');
+		else if (c == ';')
+			skip_until(r, '\n');
+		else if (c == '(')
+			skip_variation(r);
+		else if (c == '[')
+			return 2;
+		else if (!isspace(c) && c != ')' && c != '}' && c != ']')
+			break;
+		line_start = r->line_start;
+	}
+	if (c == EOF)
+		return 1;
+
+	int length = 0;
+	do {
+		if (length < PGN_TOKEN_LEN - 1)
+			r->token[length++] = c;
+		c = getc_unlocked(r->f);
+	} while (c != EOF && !isspace(c) && !strchr("{}()[];", c));
+	if (c != EOF)
+		ungetc(c, r->f);
+	r->token[length] = '\0';
+	return 0;
+}
+
+static int is_result(char* token) {
+	return strcmp(token, "1-0") == 0 || strcmp(token, "0-1") == 0 ||
+		strcmp(token, "1/2-1/2") == 0 || strcmp(token, "*") == 0;
+}
+
+// Sets up the next game from its FEN tag or the starting position, returns 1 if the FEN is bad
+static int start_game(pgn_reader* r, game* g) {
+	r->games++;
+	if (load_fen(*r->fen ? r->fen : GAME_FEN, g)) {
+		fprintf(stderr, "chess: game %llu: bad fen (line %d)\n", r->games, r->line);
+		r->errors++;
+		r->state = 2;
+		return 1;
+	}
+	r->state = 1;
+	return 0;
+}
+
+// Reads on to the next game start or move, setting up or playing it on g
+//   A game with a move that isn't legal is reported and its remaining moves
+//   skipped, so one bad game doesn't stop a whole database
+pgn_event pgn_next(pgn_reader* r, game* g) {
+	while (1) {
+		if (!r->held) {
+			int end = read_token(r);
+			if (end == 1)
+				return pgn_done;
+			if (end == 2) {
+				// Tags after moves start the next game, even without a result
+				if (r->state != 0)
+					*r->fen = '\0';
+				r->state = 0;
+				read_tag(r);
+				continue;
+			}
+		}
+		r->held = 0;
+		char* token = r->token;
+
+		// The first movetext token starts a game, and is handled on the next call
+		if (r->state == 0) {
+			r->held = 1;
+			if (start_game(r, g) == 0)
+				return pgn_game;
+			r->held = 0;
+		}
+		if (is_result(token)) {
+			r->state = 0;
+			*r->fen = '\0';
+			continue;
+		}
+		if (r->state == 2 || token[0] == '$')
+			continue;
+
+		// Move numbers, as "12.", "12..." or joined to the move ("12.e4"); castling may
+		//   be written with zeros, so digits only count as a number if dots follow
+		int digits = strspn(token, "0123456789");
+		if (token[digits] == '.')
+			token += digits;
+		token += strspn(token, ".");
+		if (!*token || strcmp(token, "e.p.") == 0)
+			continue;
+
+		move m;
+		if (g->ply >= GAME_PLY_LIMIT) {
+			// Start a new undo stack (losing repetitions before this point)
+			char fen[FEN_LEN];
+			write_fen(g, fen);
+			load_fen(fen, g);
+		}
+		if (parse_move(g, token, &m)) {
+			char fen[FEN_LEN];
+			write_fen(g, fen);
+			fprintf(stderr, "chess: game %llu: bad move %s (line %d) in %s\n", r->games, token, r->line, fen);
+			r->errors++;
+			r->state = 2;
+			continue;
+		}
+		make_move(g, m);
+		r->moves++;
+		return pgn_move;
+	}
+}
+
+// Replays every game of a PGN file ("-" for standard input), printing the totals
+//   and speed; returns the number of errors
+int pgn_run(char* path) {
+	FILE* f = strcmp(path, "-") ? fopen(path, "r") : stdin;
+	if (!f) {
+		fprintf(stderr, "chess: could not open %s\n", path);
+		return 1;
+	}
+	game* g = malloc(sizeof(game));
+	if (!g) {
+		fprintf(stderr, "chess: could not allocate game\n");
+		exit(1);
+	}
+
+	pgn_reader r;
+	pgn_open(f, &r);
+	unsigned long long start = time_ns();
+	while (pgn_next(&r, g) != pgn_done);
+	unsigned long long elapsed = time_ns() - start;
+
+	printf("games: %llu, moves: %llu, errors: %llu\n", r.games, r.moves, r.errors);
+	printf("time: %.3fs\n", elapsed / 1e9);
+	printf("games/s: %.0f, moves/s: %.0f\n",
+		elapsed ? r.games * 1e9 / elapsed : 0.0, elapsed ? r.moves * 1e9 / elapsed : 0.0);
+
+	free(g);
+	if (f != stdin)
+		fclose(f);
+	return r.errors;
+}
+
+// The result of a game for the Result tag and the end of the movetext
+static const char* result(game* g) {
+	if (g->ended == by_checkmate)
+		return (g->turn == white) ? "0-1" : "1-0";
+	return (g->ended == not_finished) ? "*" : "1/2-1/2";
+}
+
+// Writes the moves of a game in SAN with move numbers, wrapping lines, then text
+//   (e.g. the result) if given; start is the game undone to its first position
+static void write_movetext(game* start, game* g, FILE* f, const char* text) {
+	int column = 0;
+	char word[SAN_LEN + 16];
+	for (int i = 0; i <= g->ply; i++) {
+		char* p = word;
+		if (i == g->ply) {
+			if (!text)
+				break;
+			strcpy(word, text);
+		} else {
+			move m = g->history[i].m;
+			if (start->turn == white)
+				p += sprintf(p, "%d. ", start->fullmove);
+			else if (i == 0)
+				p += sprintf(p, "%d... ", start->fullmove);
+			move_san(start, m, p);
+			make_move(start, m);
+		}
+
+		int length = strlen(word);
+		if (column > 0 && column + 1 + length > PGN_LINE_LEN) {
+			fputc('\n', f);
+			column = 0;
+		} else if (column > 0) {
+			fputc(' ', f);
+			column++;
+		}
+		fputs(word, f);
+		column += length;
+	}
+	if (column > 0)
+		fputc('\n', f);
+}
+
+// Undoes a copy of a game back to its first position, returns it or NULL if it can't be allocated
+static game* first_position(game* g) {
+	game* start = malloc(sizeof(game));
+	if (!start)
+		return NULL;
+	*start = *g;
+	while (start->ply > 0)
+		undo_move(start);
+	return start;
+}
+
+// Writes the moves played so far
+void pgn_write_moves(game* g, FILE* f) {
+	game* start = first_position(g);
+	if (!start)
+		return;
+	write_movetext(start, g, f, NULL);
+	free(start);
+}
+
+// Writes a game in PGN: the seven tag roster (plus SetUp and FEN if it didn't start
+//   from the starting position), then the moves and result
+void pgn_write(game* g, FILE* f) {
+	game* start = first_position(g);
+	if (!start)
+		return;
+	char fen[FEN_LEN];
+	write_fen(start, fen);
+
+	time_t now = time(NULL);
+	struct tm* date = localtime(&now);
+	fprintf(f, "[Event \"?\"]\n[Site \"?\"]\n");
+	fprintf(f, "[Date \"%04d.%02d.%02d\"]\n", date->tm_year + 1900, date->tm_mon + 1, date->tm_mday);
+	fprintf(f, "[Round \"-\"]\n[White \"?\"]\n[Black \"?\"]\n");
+	fprintf(f, "[Result \"%s\"]\n", result(g));
+	if (strcmp(fen, GAME_FEN " w KQkq - 0 1") != 0)
+		fprintf(f, "[SetUp \"1\"]\n[FEN \"%s\"]\n", fen);
+	fprintf(f, "\n");
+	write_movetext(start, g, f, result(g));
+	fprintf(f, "\n");
+	free(start);
+}
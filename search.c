@@ -0,0 +1,540 @@
+// Chess implemented in C; search.c implements the engine, an iterative
+//   deepening alpha-beta search over make_move and undo_move. Several threads
+//   can search the same position at once (lazy SMP), each on its own copy of
+//   the game, sharing what they find through the transposition table.
+// Copyright (C) 2021 Theo Henson.
+// Released under the GPL v3.0, see LICENSE.
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "game.h"
+
+// Nodes searched between checks of the clock
+#define CHECK_INTERVAL 2048
+
+// Move ordering scores: the hash move, then captures (and queen promotions)
+//   that don't lose material by most valuable victim and least valuable
+//   attacker, then killers, then quiet moves by history, which is kept below
+//   HISTORY_MAX, then losing captures by how much they lose
+#define HASH_MOVE_SCORE (1 << 30)
+#define CAPTURE_SCORE (1 << 20)
+#define KILLER_SCORE (1 << 19)
+#define HISTORY_MAX (1 << 18)
+
+// Set to end the running search as soon as possible (searches run alone have their own)
+static int stopped = 0;
+
+// Threads used by each search, and the state of each during one
+static int thread_count = 1;
+static searcher* searchers = NULL;
+
+// What a search prints, and the nodes, cutoff counts, table counters and the second move of the PV of the last one
+static search_output output = output_text;
+static unsigned long long last_nodes = 0;
+static unsigned long long last_cutoffs = 0;
+static unsigned long long last_first_move_cutoffs = 0;
+static tt_stats last_tt_counters;
+static move ponder_move;
+static int has_ponder_move = 0;
+
+// Converts mate scores between "from the root" and "from this node" for the transposition table
+static int score_to_tt(int score, int ply) {
+	if (score > MATE_BOUND)
+		return score + ply;
+	if (score < -MATE_BOUND)
+		return score - ply;
+	return score;
+}
+
+static int score_from_tt(int score, int ply) {
+	if (score > MATE_BOUND)
+		return score - ply;
+	if (score < -MATE_BOUND)
+		return score + ply;
+	return score;
+}
+
+// Sets the number of search threads, returns 1 if it is out of range
+int search_set_threads(int n) {
+	if (n < 1 || n > MAX_THREADS)
+		return 1;
+	thread_count = n;
+	return 0;
+}
+
+int search_threads() {
+	return thread_count;
+}
+
+// Sets what searches print
+void search_set_output(search_output mode) {
+	output = mode;
+}
+
+// Returns the nodes searched by the last search
+unsigned long long search_nodes() {
+	return last_nodes;
+}
+
+// Gets the reply the last search expects to its move, returns 0 if there is none
+int search_ponder_move(move* m) {
+	if (has_ponder_move)
+		*m = ponder_move;
+	return has_ponder_move;
+}
+
+// Nodes searched so far by all threads of a search
+static unsigned long long total_nodes(searcher* s) {
+	unsigned long long nodes = 0;
+	for (int i = 0; i < s->group_size; i++)
+		nodes += __atomic_load_n(&s->group[i].nodes, __ATOMIC_RELAXED);
+	return nodes;
+}
+
+// Counts a node of the thread, returns the thread's count (only the thread
+//   writes it, so a relaxed store is enough for total_nodes to read it)
+static unsigned long long count_node(searcher* s) {
+	unsigned long long nodes = s->nodes + 1;
+	__atomic_store_n(&s->nodes, nodes, __ATOMIC_RELAXED);
+	return nodes;
+}
+
+// Ends the search on all its threads
+static void stop_search(searcher* s) {
+	__atomic_store_n(s->stopped, 1, __ATOMIC_RELAXED);
+}
+
+static int search_stopped(searcher* s) {
+	return __atomic_load_n(s->stopped, __ATOMIC_RELAXED);
+}
+
+// Ends the search once a limit is reached (only checked by thread 0)
+static void check_limits(searcher* s) {
+	if (s->limits.stop && __atomic_load_n(s->limits.stop, __ATOMIC_RELAXED))
+		stop_search(s);
+
+	// Start the clock once the ponder move is played
+	if (s->limits.ponder) {
+		if (__atomic_load_n(s->limits.ponder, __ATOMIC_RELAXED))
+			return;
+		s->limits.ponder = NULL;
+		s->clock_start = time_ns();
+	}
+
+	if (s->limits.nodes && total_nodes(s) >= s->limits.nodes)
+		stop_search(s);
+	if (s->limits.time_ms && (time_ns() - s->clock_start) / 1000000 >= s->limits.time_ms)
+		stop_search(s);
+}
+
+// Scores each move of a list for ordering
+static void score_moves(searcher* s, move_list* l, int scores[MAX_MOVES], move hash_move, int ply) {
+	game* g = s->g;
+	int c = COL_I(g->turn);
+	for (int i = 0; i < l->count; i++) {
+		move m = l->moves[i];
+		int start = MOVE_START(m), end = MOVE_END(m);
+		if (m == hash_move) {
+			scores[i] = HASH_MOVE_SCORE;
+		} else if (MOVE_CAPTURE(m) || MOVE_PROMOTION(m) == queen) {
+			int victim = MOVE_CAPTURE(m) ? ((MOVE_FLAG(m) == flag_en_passant) ? pawn : PIECE_TYPE(g->board[end])) : pawn;
+			int attacker = PIECE_TYPE(g->board[start]);
+			// Only a capture by a more valuable piece can lose material
+			int exchange = (attacker > victim && attacker != king) ? see(g, m) : 0;
+			if (exchange < 0)
+				scores[i] = exchange - HISTORY_MAX;
+			else
+				scores[i] = CAPTURE_SCORE + (MOVE_PROMOTION(m) == queen ? 64 : 0) + (victim + 1) * 8 - attacker;
+		} else if (m == s->killers[ply][0]) {
+			scores[i] = KILLER_SCORE + 1;
+		} else if (m == s->killers[ply][1]) {
+			scores[i] = KILLER_SCORE;
+		} else {
+			scores[i] = s->history[c][start][end];
+		}
+	}
+}
+
+// Swaps the best scored of the moves from index i on into place i
+static void pick_move(move_list* l, int scores[MAX_MOVES], int i) {
+	int best = i;
+	for (int j = i + 1; j < l->count; j++)
+		if (scores[j] > scores[best])
+			best = j;
+	move m = l->moves[i];
+	l->moves[i] = l->moves[best];
+	l->moves[best] = m;
+	int score = scores[i];
+	scores[i] = scores[best];
+	scores[best] = score;
+}
+
+// Remembers a quiet move that caused a cutoff, as a killer for the ply and in the history
+static void update_quiet(searcher* s, move m, int depth, int ply) {
+	if (s->killers[ply][0] != m) {
+		s->killers[ply][1] = s->killers[ply][0];
+		s->killers[ply][0] = m;
+	}
+
+	int (*history)[64] = s->history[COL_I(s->g->turn)];
+	int* entry = &history[MOVE_START(m)][MOVE_END(m)];
+	*entry += depth * depth;
+	// Halve the whole table so scores stay below killers but keep their order
+	if (*entry >= HISTORY_MAX) {
+		for (int i = 0; i < 64; i++)
+			for (int j = 0; j < 64; j++)
+				history[i][j] /= 2;
+	}
+}
+
+// Searches only captures and promotions (or every move when in check) until
+//   the position is quiet, so that the search doesn't stop in the middle of an
+//   exchange; the side to move can instead stand pat on the static evaluation
+static int quiesce(searcher* s, int ply, int alpha, int beta) {
+	game* g = s->g;
+	s->pv_length[ply] = 0;
+
+	if ((count_node(s) % CHECK_INTERVAL) == 0 && s->id == 0)
+		check_limits(s);
+	if (search_stopped(s))
+		return 0;
+	if (ply >= MAX_PLY - 1)
+		return evaluate(g);
+
+	int check = in_check(g);
+	int best_score = -INFINITE_SCORE;
+	move_list l;
+	if (check) {
+		get_moves(g, COL_I(g->turn), &l);
+		if (l.count == 0)
+			return -MATE_SCORE + ply;
+	} else {
+		best_score = evaluate(g);
+		if (best_score >= beta)
+			return best_score;
+		if (best_score > alpha)
+			alpha = best_score;
+		get_captures(g, COL_I(g->turn), &l);
+	}
+
+	int scores[MAX_MOVES];
+	score_moves(s, &l, scores, NO_MOVE, ply);
+	for (int i = 0; i < l.count; i++) {
+		pick_move(&l, scores, i);
+		move m = l.moves[i];
+		// Losing captures and underpromotions won't improve on standing pat
+		if (!check && (scores[i] < 0 || (MOVE_PROMOTION(m) && MOVE_PROMOTION(m) != queen)))
+			continue;
+
+		make_move(g, m);
+		int score = -quiesce(s, ply + 1, -beta, -alpha);
+		undo_move(g);
+		if (search_stopped(s))
+			return 0;
+
+		if (score > best_score) {
+			best_score = score;
+			if (score > alpha) {
+				alpha = score;
+				if (alpha >= beta)
+					break;
+			}
+		}
+	}
+	return best_score;
+}
+
+// Negamax alpha-beta search, returns the score of the position for the side to move
+static int alpha_beta(searcher* s, int depth, int ply, int alpha, int beta) {
+	game* g = s->g;
+	s->pv_length[ply] = 0;
+
+	if ((count_node(s) % CHECK_INTERVAL) == 0 && s->id == 0)
+		check_limits(s);
+	if (search_stopped(s))
+		return 0;
+
+	// Draws by repetition (once is enough inside the search), the fifty-move rule or lack of material
+	if (ply > 0 && (repetitions(g) || g->halfmove_clock >= 100 || insufficient_material(g)))
+		return 0;
+
+	if (depth <= 0 || ply >= MAX_PLY - 1)
+		return quiesce(s, ply, alpha, beta);
+
+	// Use a stored result if it was searched at least as deep, else try its move first
+	int tt_depth, tt_score, tt_bound, tt_move;
+	move hash_move = NO_MOVE;
+	if (tt_probe(g->hash, &tt_depth, &tt_score, &tt_bound, &tt_move)) {
+		hash_move = tt_move;
+		tt_score = score_from_tt(tt_score, ply);
+		if (ply > 0 && tt_depth >= depth && (tt_bound == bound_exact ||
+			(tt_bound == bound_lower && tt_score >= beta) ||
+			(tt_bound == bound_upper && tt_score <= alpha)))
+			return tt_score;
+	}
+
+	move_list l;
+	get_moves(g, COL_I(g->turn), &l);
+
+	// Checkmate or stalemate
+	if (l.count == 0)
+		return in_check(g) ? -MATE_SCORE + ply : 0;
+
+	int scores[MAX_MOVES];
+	score_moves(s, &l, scores, hash_move, ply);
+
+	int original_alpha = alpha;
+	int best_score = -INFINITE_SCORE;
+	move best_move = NO_MOVE;
+	for (int i = 0; i < l.count; i++) {
+		pick_move(&l, scores, i);
+		move m = l.moves[i];
+		make_move(g, m);
+		int score = -alpha_beta(s, depth - 1, ply + 1, -beta, -alpha);
+		undo_move(g);
+		if (search_stopped(s))
+			return 0;
+
+		if (score > best_score) {
+			best_score = score;
+			best_move = m;
+			if (score > alpha) {
+				alpha = score;
+
+				// Principal variation is this move followed by the child's
+				s->pv[ply][0] = m;
+				memcpy(&s->pv[ply][1], s->pv[ply + 1], s->pv_length[ply + 1] * sizeof(move));
+				s->pv_length[ply] = s->pv_length[ply + 1] + 1;
+
+				if (alpha >= beta) {
+					s->cutoffs++;
+					if (i == 0)
+						s->first_move_cutoffs++;
+					if (!MOVE_CAPTURE(m) && !MOVE_PROMOTION(m))
+						update_quiet(s, m, depth, ply);
+					break;
+				}
+			}
+		}
+	}
+
+	int bound = (best_score >= beta) ? bound_lower : (best_score > original_alpha) ? bound_exact : bound_upper;
+	tt_store(g->hash, depth, score_to_tt(best_score, ply), bound, best_move);
+	return best_score;
+}
+
+// Prints the principal variation in coordinate notation
+static void print_pv(move* pv, int length) {
+	char notation[6];
+	for (int i = 0; i < length; i++) {
+		move_notation(pv[i], notation);
+		printf(" %s", notation);
+	}
+}
+
+// Prints a finished iteration of thread 0
+static void print_iteration(searcher* s, int depth, int score) {
+	unsigned long long nodes = total_nodes(s);
+	unsigned long long elapsed = time_ns() - s->start_time;
+	double nps = elapsed ? nodes * 1e9 / elapsed : 0.0;
+	printf((output == output_uci) ? "info depth %d score " : "depth %d score ", depth);
+	if (score > MATE_BOUND)
+		printf("mate %d", (MATE_SCORE - score + 1) / 2);
+	else if (score < -MATE_BOUND)
+		printf("mate -%d", (MATE_SCORE + score) / 2);
+	else
+		printf("cp %d", score);
+	if (output == output_uci)
+		printf(" nodes %llu nps %.0f time %llu pv", nodes, nps, elapsed / 1000000);
+	else
+		printf(" nodes %llu nps %.0f time %.3fs pv", nodes, nps, elapsed / 1e9);
+	print_pv(s->pv[0], s->pv_length[0]);
+	printf("\n");
+}
+
+// Iterative deepening loop of one thread; thread 0 decides when the search
+//   ends, the others start every other iteration one ply deeper so that the
+//   threads spread over different parts of the tree
+static void iterate(searcher* s, int verbose) {
+	int max_depth = (s->limits.depth > 0 && s->limits.depth < MAX_PLY) ? s->limits.depth : MAX_PLY - 1;
+	for (int depth = 1; depth <= max_depth; depth++) {
+		int search_depth = depth;
+		if (s->id > 0 && (s->id & 1) && depth < max_depth)
+			search_depth++;
+
+		int score = alpha_beta(s, search_depth, 0, -INFINITE_SCORE, INFINITE_SCORE);
+		// An unfinished iteration can't be trusted
+		if (search_stopped(s))
+			break;
+		if (s->id > 0)
+			continue;
+
+		if (s->pv_length[0] > 0)
+			s->best = s->pv[0][0];
+		s->ponder = (s->pv_length[0] > 1) ? s->pv[0][1] : NO_MOVE;
+		s->depth = depth;
+		s->score = score;
+		if (verbose)
+			print_iteration(s, depth, score);
+
+		// A forced mate won't get any better
+		if (score > MATE_BOUND || score < -MATE_BOUND)
+			break;
+		// Another iteration would take longer than the time left
+		unsigned long long elapsed = time_ns() - s->clock_start;
+		int pondering = s->limits.ponder && __atomic_load_n(s->limits.ponder, __ATOMIC_RELAXED);
+		if (s->limits.time_ms && !pondering && elapsed / 1000000 >= s->limits.time_ms / 2)
+			break;
+	}
+}
+
+static void* search_thread(void* arg) {
+	searcher* s = arg;
+	iterate(s, 0);
+	s->tt_counters = tt_counters;
+	stats_flush();
+	return NULL;
+}
+
+// Searches with all threads until thread 0 is done, returns the nodes searched
+static unsigned long long run_search(game* g, search_limits* limits, move* best, int verbose) {
+	searchers = malloc(thread_count * sizeof(searcher));
+	game* games = malloc(thread_count * sizeof(game));
+	pthread_t threads[MAX_THREADS];
+	if (!searchers || !games) {
+		fprintf(stderr, "chess: could not allocate search threads\n");
+		exit(1);
+	}
+
+	unsigned long long start_time = time_ns();
+	__atomic_store_n(&stopped, 0, __ATOMIC_RELAXED);
+	tt_new_search();
+	for (int i = 0; i < thread_count; i++) {
+		games[i] = *g;
+		searchers[i] = (searcher){
+			.id = i,
+			.g = &games[i],
+			.limits = *limits,
+			.nodes = 0,
+			.start_time = start_time,
+			.clock_start = start_time,
+			.group = searchers,
+			.group_size = thread_count,
+			.stopped = &stopped,
+			.best = *best
+		};
+	}
+
+	// Thread 0 runs on the calling thread, counting from zero like the others;
+	//   the counters of all threads are then added to the caller's
+	tt_stats caller_counters = tt_counters;
+	memset(&tt_counters, 0, sizeof(tt_counters));
+	for (int i = 1; i < thread_count; i++)
+		pthread_create(&threads[i], NULL, search_thread, &searchers[i]);
+	iterate(&searchers[0], verbose);
+	stop_search(&searchers[0]);
+	for (int i = 1; i < thread_count; i++) {
+		pthread_join(threads[i], NULL);
+		tt_add_stats(&searchers[i].tt_counters);
+	}
+	last_tt_counters = tt_counters;
+	tt_counters = caller_counters;
+	tt_add_stats(&last_tt_counters);
+
+	unsigned long long nodes = total_nodes(&searchers[0]);
+	*best = searchers[0].best;
+	has_ponder_move = searchers[0].ponder != NO_MOVE;
+	ponder_move = searchers[0].ponder;
+	last_cutoffs = last_first_move_cutoffs = 0;
+	for (int i = 0; i < thread_count; i++) {
+		last_cutoffs += searchers[i].cutoffs;
+		last_first_move_cutoffs += searchers[i].first_move_cutoffs;
+	}
+	free(games);
+	free(searchers);
+	searchers = NULL;
+	return nodes;
+}
+
+// Searches a position with iterative deepening until a limit is reached,
+//   printing each completed iteration unless told not to; returns 0 if there are no legal moves
+int search(game* g, search_limits* limits, move* best) {
+	last_nodes = 0;
+	has_ponder_move = 0;
+	move_list root;
+	get_moves(g, COL_I(g->turn), &root);
+	if (root.count == 0)
+		return 0;
+	*best = root.moves[0];
+
+	last_nodes = run_search(g, limits, best, output != output_none);
+	if (output == output_none)
+		return 1;
+	printf((output == output_uci) ? "info string cutoffs %llu, on the first move %.1f%%" : "cutoffs %llu, on the first move %.1f%%",
+		last_cutoffs, last_cutoffs ? last_first_move_cutoffs * 100.0 / last_cutoffs : 0.0);
+	printf(", pawn probes %llu, hits %.1f%%\n", last_tt_counters.pawn_probes,
+		last_tt_counters.pawn_probes ? last_tt_counters.pawn_hits * 100.0 / last_tt_counters.pawn_probes : 0.0);
+	return 1;
+}
+
+// Searches a position on the calling thread alone, using a searcher of the
+//   caller's and sharing only the transposition table, so that many positions
+//   can be searched at once; returns 0 if there are no legal moves, else the
+//   result of the last finished iteration is left in s
+int search_alone(searcher* s, game* g, search_limits* limits) {
+	move_list root;
+	get_moves(g, COL_I(g->turn), &root);
+	if (root.count == 0)
+		return 0;
+
+	int stop = 0;
+	unsigned long long start_time = time_ns();
+	memset(s, 0, sizeof(searcher));
+	s->g = g;
+	s->limits = *limits;
+	s->start_time = s->clock_start = start_time;
+	s->group = s;
+	s->group_size = 1;
+	s->stopped = &stop;
+	s->best = root.moves[0];
+	iterate(s, 0);
+	s->stopped = NULL;
+	return 1;
+}
+
+// Searches a position with 1, 2, 4 ... up to the set number of threads,
+//   printing the speed of each compared to one thread
+void search_scaling(game* g, search_limits* limits) {
+	move_list root;
+	get_moves(g, COL_I(g->turn), &root);
+	if (root.count == 0) {
+		printf("no moves\n");
+		return;
+	}
+
+	int threads = thread_count;
+	double base_nps = 0;
+	for (int n = 1; ; n *= 2) {
+		if (n > threads)
+			n = threads;
+		thread_count = n;
+		// Each thread count starts from an empty table, as the first would
+		tt_clear();
+		move best = root.moves[0];
+		unsigned long long start = time_ns();
+		unsigned long long nodes = run_search(g, limits, &best, 0);
+		unsigned long long elapsed = time_ns() - start;
+
+		double nps = elapsed ? nodes * 1e9 / elapsed : 0.0;
+		if (n == 1)
+			base_nps = nps;
+		printf("threads %d nodes %llu time %.3fs nps %.0f speedup %.2fx\n",
+			n, nodes, elapsed / 1e9, nps, base_nps ? nps / base_nps : 0.0);
+		if (n == threads)
+			break;
+	}
+	thread_count = threads;
+}
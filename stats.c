@@ -0,0 +1,86 @@
+// Chess implemented in C; stats.c implements the hot path instrumentation:
+//   each thread counts calls and clock ticks into its own counters, which it
+//   adds to the totals when it finishes. The counting is compiled out unless
+//   built with make INSTRUMENT=1.
+// Copyright (C) 2021 Theo Henson.
+// Released under the GPL v3.0, see LICENSE.
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "game.h"
+
+#ifndef INSTRUMENT
+#define STATS_UNIT "ticks"
+#endif
+
+static const char* stat_names[stat_count] = {
+	"get_piece_moves pawn",
+	"get_piece_moves knight",
+	"get_piece_moves bishop",
+	"get_piece_moves rook",
+	"get_piece_moves queen",
+	"get_piece_moves king",
+	"filter_legal_moves",
+	"make_move",
+	"undo_move",
+	"tile_attacked",
+	"new_move"
+};
+
+__thread stats_counters stats_local;
+
+// Counters of finished threads
+static stats_counters totals;
+static pthread_mutex_t totals_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Returns whether the counting is compiled in
+int stats_enabled() {
+#ifdef INSTRUMENT
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+// Adds the calling thread's counters to the totals and clears them, called
+//   by each thread that plays moves before it ends
+void stats_flush() {
+	if (!stats_enabled())
+		return;
+	pthread_mutex_lock(&totals_lock);
+	for (int i = 0; i < stat_count; i++) {
+		totals.calls[i] += stats_local.calls[i];
+		totals.ticks[i] += stats_local.ticks[i];
+	}
+	pthread_mutex_unlock(&totals_lock);
+	memset(&stats_local, 0, sizeof(stats_local));
+}
+
+void stats_reset() {
+	pthread_mutex_lock(&totals_lock);
+	memset(&totals, 0, sizeof(totals));
+	pthread_mutex_unlock(&totals_lock);
+	memset(&stats_local, 0, sizeof(stats_local));
+}
+
+// Prints the totals so far, including the calling thread's counters
+void stats_print() {
+	if (!stats_enabled()) {
+		printf("instrumentation not built in (make clean, then make INSTRUMENT=1)\n");
+		return;
+	}
+	stats_flush();
+	pthread_mutex_lock(&totals_lock);
+	printf("%-24s %14s %16s %10s\n", "function", "calls", STATS_UNIT, "per call");
+	for (int i = 0; i < stat_count; i++) {
+		// Moves are only counted, timing a single store would cost more than it
+		if (i == stat_new_move)
+			printf("%-24s %14llu\n", stat_names[i], totals.calls[i]);
+		else
+			printf("%-24s %14llu %16llu %10.1f\n", stat_names[i], totals.calls[i], totals.ticks[i],
+				totals.calls[i] ? (double)totals.ticks[i] / totals.calls[i] : 0.0);
+	}
+	pthread_mutex_unlock(&totals_lock);
+}
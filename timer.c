@@ -0,0 +1,14 @@
+// Chess implemented in C; timer.c implements wall clock timing.
+// Copyright (C) 2021 Theo Henson.
+// Released under the GPL v3.0, see LICENSE.
+
+#include <time.h>
+
+#include "game.h"
+
+// Returns nanoseconds elapsed on a monotonic clock
+unsigned long long time_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
@@ -0,0 +1,195 @@
+// Chess implemented in C; tt.c implements the transposition table,
+//   a fixed size hash table of search results keyed by position hash.
+//   It is shared by search threads without locks: each entry stores key ^ data,
+//   so an entry torn by two threads writing at once fails the key check.
+// Copyright (C) 2021 Theo Henson.
+// Released under the GPL v3.0, see LICENSE.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "game.h"
+
+// Layout of the data word of an entry; depth and age are shared by search and perft entries
+//   (the move is stored as is, in its packed 16 bits)
+#define DATA_MOVE(data) ((int)((data) & 0xffff))
+#define DATA_SCORE(data) ((int)(short)(((data) >> 16) & 0xffff))
+#define DATA_NODES(data) ((data) & 0xffffffffffffULL)
+#define DATA_AGE(data) ((int)(((data) >> 48) & 0x3f))
+#define DATA_BOUND(data) ((int)(((data) >> 54) & 0x3))
+#define DATA_DEPTH(data) ((int)((data) >> 56))
+
+// Perft counts are stored under a key that also depends on the depth
+#define PERFT_KEY(hash, depth) ((hash) ^ ((unsigned long long)(depth) * 0x9e3779b97f4a7c15ULL))
+
+static tt_bucket* table = NULL;
+static unsigned long long bucket_count = 0;
+static int age = 0;
+// Counters of the calling thread
+__thread tt_stats tt_counters;
+
+// Allocates a table of at most mb megabytes (rounded down to a power of two buckets), 0 frees it
+//   Returns 0 on success
+int tt_resize(int mb) {
+	free(table);
+	table = NULL;
+	bucket_count = 0;
+	if (mb <= 0)
+		return 0;
+
+	unsigned long long buckets = 1;
+	while (buckets * 2 * sizeof(tt_bucket) <= (unsigned long long)mb * 1024 * 1024)
+		buckets *= 2;
+
+	table = aligned_alloc(sizeof(tt_bucket), buckets * sizeof(tt_bucket));
+	if (!table)
+		return 1;
+	bucket_count = buckets;
+	tt_clear();
+	return 0;
+}
+
+// Returns the size of the table in megabytes
+int tt_size() {
+	return (int)(bucket_count * sizeof(tt_bucket) / (1024 * 1024));
+}
+
+// Empties the table and resets the counters
+void tt_clear() {
+	if (table)
+		memset(table, 0, bucket_count * sizeof(tt_bucket));
+	memset(&tt_counters, 0, sizeof(tt_counters));
+	age = 0;
+}
+
+// Adds counters from another thread to the calling thread's
+void tt_add_stats(tt_stats* stats) {
+	tt_counters.probes += stats->probes;
+	tt_counters.hits += stats->hits;
+	tt_counters.misses += stats->misses;
+	tt_counters.stores += stats->stores;
+	tt_counters.collisions += stats->collisions;
+	tt_counters.pawn_probes += stats->pawn_probes;
+	tt_counters.pawn_hits += stats->pawn_hits;
+}
+
+// Marks the start of a new search, so entries from older searches are replaced first
+void tt_new_search() {
+	age = (age + 1) & 0x3f;
+}
+
+static tt_bucket* bucket(unsigned long long key) {
+	return &table[key & (bucket_count - 1)];
+}
+
+// Reads an entry, other threads may be writing to it at the same time
+static void load(tt_entry* e, unsigned long long* key, unsigned long long* data) {
+	*data = __atomic_load_n(&e->data, __ATOMIC_RELAXED);
+	*key = __atomic_load_n(&e->key, __ATOMIC_RELAXED) ^ *data;
+}
+
+// Finds the data of the entry for a key, returns 0 if there is none
+static unsigned long long find(unsigned long long key) {
+	if (!table)
+		return 0;
+	tt_counters.probes++;
+	tt_bucket* b = bucket(key);
+	for (int i = 0; i < TT_BUCKET_SIZE; i++) {
+		unsigned long long entry_key, data;
+		load(&b->entries[i], &entry_key, &data);
+		if (entry_key == key && data) {
+			tt_counters.hits++;
+			return data;
+		}
+	}
+	tt_counters.misses++;
+	return 0;
+}
+
+// Writes an entry, preferring to replace the same position, then the
+//   shallowest entry with older searches counting as shallower
+static void store(unsigned long long key, int depth, unsigned long long data) {
+	if (!table)
+		return;
+	tt_bucket* b = bucket(key);
+	tt_entry* replace = &b->entries[0];
+	unsigned long long replace_key = 0, replace_data = 0;
+	int worst = 1 << 30;
+	for (int i = 0; i < TT_BUCKET_SIZE; i++) {
+		unsigned long long entry_key, entry_data;
+		load(&b->entries[i], &entry_key, &entry_data);
+		if (entry_key == key || !entry_data) {
+			replace = &b->entries[i];
+			replace_key = entry_key;
+			replace_data = entry_data;
+			break;
+		}
+		int value = DATA_DEPTH(entry_data) - 8 * ((age - DATA_AGE(entry_data)) & 0x3f);
+		if (value < worst) {
+			worst = value;
+			replace = &b->entries[i];
+			replace_key = entry_key;
+			replace_data = entry_data;
+		}
+	}
+
+	// Keep deeper results for the same position from this search
+	if (replace_key == key && replace_data &&
+		DATA_AGE(replace_data) == age && DATA_DEPTH(replace_data) > depth)
+		return;
+	if (replace_data && replace_key != key)
+		tt_counters.collisions++;
+
+	tt_counters.stores++;
+	data |= ((unsigned long long)age << 48) | ((unsigned long long)depth << 56);
+	__atomic_store_n(&replace->key, key ^ data, __ATOMIC_RELAXED);
+	__atomic_store_n(&replace->data, data, __ATOMIC_RELAXED);
+}
+
+// Looks up a search result, returns whether one was found
+int tt_probe(unsigned long long key, int* depth, int* score, int* bound, int* move) {
+	unsigned long long data = find(key);
+	if (!data)
+		return 0;
+	*depth = DATA_DEPTH(data);
+	*score = DATA_SCORE(data);
+	*bound = DATA_BOUND(data);
+	*move = DATA_MOVE(data);
+	return 1;
+}
+
+// Saves a search result
+void tt_store(unsigned long long key, int depth, int score, int bound, int move) {
+	unsigned long long data = (unsigned long long)(move & 0xffff) |
+		((unsigned long long)(score & 0xffff) << 16) |
+		((unsigned long long)bound << 54);
+	store(key, depth, data);
+}
+
+// Looks up a perft count, returns whether one was found
+int tt_probe_perft(unsigned long long key, int depth, unsigned long long* nodes) {
+	unsigned long long data = find(PERFT_KEY(key, depth));
+	if (!data)
+		return 0;
+	*nodes = DATA_NODES(data);
+	return 1;
+}
+
+// Saves a perft count
+void tt_store_perft(unsigned long long key, int depth, unsigned long long nodes) {
+	store(PERFT_KEY(key, depth), depth, DATA_NODES(nodes) | ((unsigned long long)bound_exact << 54));
+}
+
+// Prints the table size and counters
+void tt_print_stats() {
+	printf("hash: %d MB (%llu entries)\n", tt_size(), bucket_count * TT_BUCKET_SIZE);
+	printf("probes: %llu, hits: %llu (%.1f%%), misses: %llu\n",
+		tt_counters.probes, tt_counters.hits,
+		tt_counters.probes ? tt_counters.hits * 100.0 / tt_counters.probes : 0.0,
+		tt_counters.misses);
+	printf("stores: %llu, collisions: %llu\n", tt_counters.stores, tt_counters.collisions);
+	if (tt_counters.pawn_probes)
+		printf("pawn probes: %llu, hits: %llu (%.1f%%)\n", tt_counters.pawn_probes, tt_counters.pawn_hits,
+			tt_counters.pawn_hits * 100.0 / tt_counters.pawn_probes);
+}
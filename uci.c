@@ -0,0 +1,280 @@
+// Chess implemented in C; uci.c implements the Universal Chess Interface,
+//   so that the engine can be used by chess GUIs and tournament managers.
+//   Commands are read on the main thread while searches run on another.
+// Copyright (C) 2021 Theo Henson.
+// Released under the GPL v3.0, see LICENSE.
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "game.h"
+
+// Longest command read, and time kept back from each move for communication
+#define UCI_LINE_LEN 16384
+#define MOVE_OVERHEAD_MS 10
+// Moves the remaining time is spread over when the GUI doesn't say
+#define DEFAULT_MOVES_TO_GO 30
+
+static game* position;
+static search_limits go_limits;
+static pthread_t search_thread;
+static int searching = 0;
+
+// Flags the search reads to stop, or to wait before its limits count (only
+//   accessed with relaxed atomics, as the search thread reads them)
+static int stop = 0;
+static int pondering = 0;
+
+// The best move is held back while searching infinitely or pondering
+//   until the GUI sends stop or ponderhit
+static pthread_mutex_t hold_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t hold_released = PTHREAD_COND_INITIALIZER;
+static int hold = 0;
+
+static void release_hold() {
+	pthread_mutex_lock(&hold_lock);
+	hold = 0;
+	pthread_cond_signal(&hold_released);
+	pthread_mutex_unlock(&hold_lock);
+}
+
+static void* run_search(void* arg) {
+	move best, ponder;
+	int found = search(position, &go_limits, &best);
+
+	pthread_mutex_lock(&hold_lock);
+	while (hold)
+		pthread_cond_wait(&hold_released, &hold_lock);
+	pthread_mutex_unlock(&hold_lock);
+
+	char notation[6], ponder_notation[6];
+	if (!found) {
+		printf("bestmove 0000\n");
+	} else if (search_ponder_move(&ponder)) {
+		move_notation(best, notation);
+		move_notation(ponder, ponder_notation);
+		printf("bestmove %s ponder %s\n", notation, ponder_notation);
+	} else {
+		move_notation(best, notation);
+		printf("bestmove %s\n", notation);
+	}
+	stats_flush();
+	return NULL;
+}
+
+// Ends a running search, waiting for it to print its move
+static void stop_search() {
+	if (!searching)
+		return;
+	__atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+	release_hold();
+	pthread_join(search_thread, NULL);
+	searching = 0;
+}
+
+// Sets up "startpos [moves ...]" or "fen <fen> [moves ...]"
+static void set_position(char* args) {
+	char* moves = strstr(args, "moves");
+	if (moves)
+		*(moves - (moves > args)) = '\0';
+
+	if (strncmp(args, "startpos", 8) == 0) {
+		load_fen(GAME_FEN, position);
+	} else if (strncmp(args, "fen ", 4) == 0) {
+		if (load_fen(args + 4, position)) {
+			printf("info string bad fen\n");
+			load_fen(GAME_FEN, position);
+			return;
+		}
+	} else {
+		printf("info string bad position\n");
+		return;
+	}
+
+	if (!moves)
+		return;
+	for (char* text = strtok(moves + 5, " "); text; text = strtok(NULL, " ")) {
+		move m;
+		if (parse_move(position, text, &m)) {
+			printf("info string bad move %s\n", text);
+			return;
+		}
+		make_move(position, m);
+
+		// Start a new undo stack from here when a long game fills it
+		if (position->ply >= GAME_PLY_LIMIT) {
+			char fen[FEN_LEN];
+			write_fen(position, fen);
+			load_fen(fen, position);
+		}
+	}
+}
+
+// Reads the value of a go argument, 0 if there is none
+static unsigned long long go_value(char** save) {
+	char* value = strtok_r(NULL, " ", save);
+	return value ? strtoull(value, NULL, 10) : 0;
+}
+
+// Starts a search from "go [wtime x] [btime x] [winc x] [binc x] [movestogo x]
+//   [movetime x] [depth x] [nodes x] [infinite] [ponder]"
+static void go(char* args) {
+	stop_search();
+
+	unsigned long long time[2] = { 0, 0 }, increment[2] = { 0, 0 };
+	unsigned long long moves_to_go = 0, move_time = 0;
+	int infinite = 0, ponder = 0;
+	search_limits limits = { .depth = 0, .time_ms = 0, .nodes = 0, .stop = &stop, .ponder = NULL };
+
+	char* save;
+	for (char* arg = strtok_r(args, " ", &save); arg; arg = strtok_r(NULL, " ", &save)) {
+		if (strcmp(arg, "wtime") == 0)
+			time[0] = go_value(&save);
+		else if (strcmp(arg, "btime") == 0)
+			time[1] = go_value(&save);
+		else if (strcmp(arg, "winc") == 0)
+			increment[0] = go_value(&save);
+		else if (strcmp(arg, "binc") == 0)
+			increment[1] = go_value(&save);
+		else if (strcmp(arg, "movestogo") == 0)
+			moves_to_go = go_value(&save);
+		else if (strcmp(arg, "movetime") == 0)
+			move_time = go_value(&save);
+		else if (strcmp(arg, "depth") == 0)
+			limits.depth = (int)go_value(&save);
+		else if (strcmp(arg, "nodes") == 0)
+			limits.nodes = go_value(&save);
+		else if (strcmp(arg, "infinite") == 0)
+			infinite = 1;
+		else if (strcmp(arg, "ponder") == 0)
+			ponder = 1;
+	}
+
+	// Use a share of the remaining time, keeping some back for communication
+	int c = COL_I(position->turn);
+	if (move_time) {
+		limits.time_ms = move_time;
+	} else if (time[c]) {
+		limits.time_ms = time[c] / (moves_to_go ? moves_to_go : DEFAULT_MOVES_TO_GO) + increment[c] * 3 / 4;
+		if (limits.time_ms + MOVE_OVERHEAD_MS > time[c])
+			limits.time_ms = time[c] > 2 * MOVE_OVERHEAD_MS ? time[c] - 2 * MOVE_OVERHEAD_MS : time[c] / 2;
+	}
+	if (limits.time_ms > MOVE_OVERHEAD_MS)
+		limits.time_ms -= MOVE_OVERHEAD_MS;
+	else if (move_time || time[c])
+		limits.time_ms = 1;
+	if (infinite)
+		limits.time_ms = limits.nodes = limits.depth = 0;
+
+	// Play straight from the book when the GUI wants a move now
+	move book_move;
+	if (!infinite && !ponder && book_probe(position, &book_move)) {
+		char notation[6];
+		move_notation(book_move, notation);
+		printf("bestmove %s\n", notation);
+		return;
+	}
+
+	__atomic_store_n(&stop, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&pondering, ponder, __ATOMIC_RELAXED);
+	if (ponder)
+		limits.ponder = &pondering;
+	hold = infinite || ponder;
+	go_limits = limits;
+	searching = 1;
+	pthread_create(&search_thread, NULL, run_search, NULL);
+}
+
+// Handles "setoption name <name> value <value>"
+static void set_option(char* args) {
+	char* name = strstr(args, "name ");
+	char* value = strstr(args, " value ");
+	if (!name || !value)
+		return;
+	*value = '\0';
+	name += 5;
+	value += 7;
+
+	if (strcmp(name, "Hash") == 0) {
+		if (tt_resize(atoi(value)))
+			printf("info string could not allocate hash table\n");
+	} else if (strcmp(name, "Threads") == 0) {
+		if (search_set_threads(atoi(value)))
+			printf("info string bad thread count\n");
+	} else if (strcmp(name, "BookFile") == 0) {
+		// An empty value (or <empty>, as some GUIs send) turns the book off
+		if (*value == '\0' || strcmp(value, "<empty>") == 0)
+			book_close();
+		else if (book_open(value))
+			printf("info string could not open book %s\n", value);
+	} else {
+		printf("info string unknown option %s\n", name);
+	}
+}
+
+// Answers the uci command with the engine's name and options
+static void identify() {
+	printf("id name chess\n");
+	printf("id author Theo Henson\n");
+	printf("option name Hash type spin default %d min 0 max 65536\n", tt_size());
+	printf("option name Threads type spin default %d min 1 max %d\n", search_threads(), MAX_THREADS);
+	printf("option name Ponder type check default false\n");
+	printf("option name BookFile type string default <empty>\n");
+	printf("uciok\n");
+}
+
+// Talks UCI on standard input and output until quit, first answering the
+//   uci command if it was what switched to this mode
+void uci(game* g, int greet) {
+	position = g;
+	char* line = malloc(UCI_LINE_LEN);
+	if (!line) {
+		fprintf(stderr, "chess: could not allocate input buffer\n");
+		exit(1);
+	}
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	search_set_output(output_uci);
+
+	if (greet)
+		identify();
+
+	while (fgets(line, UCI_LINE_LEN, stdin)) {
+		line[strcspn(line, "\r\n")] = '\0';
+		char* command = line + strspn(line, " \t");
+		char* args = command + strcspn(command, " \t");
+		if (*args)
+			*args++ = '\0';
+
+		if (strcmp(command, "uci") == 0) {
+			identify();
+		} else if (strcmp(command, "isready") == 0) {
+			printf("readyok\n");
+		} else if (strcmp(command, "ucinewgame") == 0) {
+			stop_search();
+			tt_clear();
+		} else if (strcmp(command, "position") == 0) {
+			stop_search();
+			set_position(args);
+		} else if (strcmp(command, "go") == 0) {
+			go(args);
+		} else if (strcmp(command, "stop") == 0) {
+			stop_search();
+		} else if (strcmp(command, "ponderhit") == 0) {
+			// Carry on as a normal search, now against the clock
+			__atomic_store_n(&pondering, 0, __ATOMIC_RELAXED);
+			if (go_limits.time_ms || go_limits.depth || go_limits.nodes)
+				release_hold();
+		} else if (strcmp(command, "setoption") == 0) {
+			stop_search();
+			set_option(args);
+		} else if (strcmp(command, "quit") == 0) {
+			break;
+		}
+	}
+
+	stop_search();
+	free(line);
+	exit(0);
+}
@@ -0,0 +1,77 @@
+// Chess implemented in C; zobrist.c implements Zobrist hashing of positions.
+// Copyright (C) 2021 Theo Henson.
+// Released under the GPL v3.0, see LICENSE.
+
+#include "game.h"
+
+// Random keys XORed together to form a position hash
+unsigned long long zobrist_pieces[2][6][64];
+unsigned long long zobrist_castle[16];
+unsigned long long zobrist_en_passant[8];
+unsigned long long zobrist_turn;
+
+// Xorshift64* generator, seeded with a constant so hashes are the same every run
+static unsigned long long random_key() {
+	static unsigned long long state = 0x9e3779b97f4a7c15ULL;
+	state ^= state >> 12;
+	state ^= state << 25;
+	state ^= state >> 27;
+	return state * 0x2545f4914f6cdd1dULL;
+}
+
+// Fills the key tables
+void compute_zobrist_keys() {
+	for (int c = 0; c < 2; c++)
+		for (int type = pawn; type <= king; type++)
+			for (int tile = 0; tile < 64; tile++)
+				zobrist_pieces[c][type][tile] = random_key();
+
+	// Every combination of castling rights gets its own key
+	for (int i = 0; i < 16; i++)
+		zobrist_castle[i] = random_key();
+	for (int i = 0; i < 8; i++)
+		zobrist_en_passant[i] = random_key();
+	zobrist_turn = random_key();
+}
+
+// Computes the hash of a position from scratch
+unsigned long long hash_position(game* g) {
+	unsigned long long hash = 0;
+	for (int tile = 0; tile < 64; tile++) {
+		int piece = g->board[tile];
+		if (piece)
+			hash ^= zobrist_pieces[COL_I(piece)][PIECE_TYPE(piece)][tile];
+	}
+
+	hash ^= zobrist_castle[g->castle_rights];
+	if (g->en_passant != -1)
+		hash ^= zobrist_en_passant[g->en_passant % 8];
+	if (g->turn == black)
+		hash ^= zobrist_turn;
+	return hash;
+}
+
+// Computes the hash of just the pawns of a position from scratch
+unsigned long long hash_pawns(game* g) {
+	unsigned long long hash = 0;
+	for (int c = 0; c < 2; c++)
+		for (bitboard b = g->bitboards[c][pawn]; b; b &= b - 1)
+			hash ^= zobrist_pieces[c][pawn][LSB(b)];
+	return hash;
+}
+
+// Returns how many times the current position occurred earlier in the game,
+//   only looking back as far as the last capture or pawn move
+int repetitions(game* g) {
+	int count = 0;
+	int stop = g->ply - g->halfmove_clock;
+	if (stop < 0)
+		stop = 0;
+
+	// Positions with the other side to move can't match
+	for (int i = g->ply - 2; i >= stop; i -= 2) {
+		if (g->history[i].hash == g->hash)
+			count++;
+	}
+	return count;
+}